@@ -0,0 +1,250 @@
+#!/usr/bin/env python3
+"""compare.py - does a candidate kernel regress against a baseline, cell by cell?
+
+usage: ./compare.py result-sweep-mmap.csv [more.csv records.jsonl ...] [-b baseline_hash] [-t 0.05]
+
+reads sweep.py datasets and/or the driver's JSON records, splits them by kernel hash, and matches
+runs across kernels by configuration (workload, smokewagon, threads, threads per cpu, placement,
+pages, threads or processes, filesystem behind file-backed workloads, file size, duration). for
+every matched cell it compares the baseline's per-run throughputs with each candidate's, with a
+two-sided Mann-Whitney U test by default or a bootstrap confidence interval on the ratio of medians
+with --test bootstrap, and prints a speedup table.
+
+runs that had errors or ran on a cpu the low-noise mode flagged as jittery are left out, and
+counted, unless -k keeps them.
+
+a cell regresses when the candidate is more than -t slower (5% by default) and the difference is
+significant at -a (0.05). with 3 runs a side Mann-Whitney can't get below p=0.1, so either take more
+repetitions or raise -a. exits 1 if any cell regressed, so a bench box can gate kernels on it.
+
+latency is mean ns per op per thread, threads * duration / loops. it's reported alongside, but being
+derived from the same loop counts it moves exactly opposite to throughput and isn't tested apart.
+
+only the standard library, like sweep.py.
+"""
+
+import argparse
+import csv
+import json
+import math
+import random
+import statistics
+import sys
+from collections import defaultdict
+
+CONFIG = ["workload", "smokewagon", "threads", "threads_per_cpu", "placement", "pages", "workers", "backing_fs", "file_mib", "duration_s"]
+
+DRIVER_FILE_MIB = 1024          # the driver's -z default, for records from before -z
+
+
+def load(path):
+    """one dict per run, with the CONFIG keys, kernel_hash and loops_per_sec"""
+    runs = []
+    if path.endswith(".jsonl"):
+        with open(path) as f:
+            for line in f:
+                if not line.strip():
+                    continue
+                record = json.loads(line)
+                config = record["config"]
+                runs.append({
+                    "workload": record["workload"],
+                    "smokewagon": config["smokewagon"],
+                    "threads": config["threads"],
+                    "threads_per_cpu": config.get("threads_per_cpu", 1),
+                    "placement": config.get("placement", "pinned"),
+                    "pages": config.get("pages", 1),
+                    "workers": config.get("workers", "threads"),
+                    "backing_fs": record.get("backing", {}).get("fs", ""),
+                    "file_mib": config.get("file_mib", DRIVER_FILE_MIB),
+                    "duration_s": config["duration_s"],
+                    "kernel_hash": record["kernel"]["hash"],
+                    "loops_per_sec": record["loops"] / config["duration_s"],
+                    "errors": record["errors"],
+                    "jittery_cpus": record.get("noise", {}).get("jittery_cpus", ""),
+                })
+    else:
+        with open(path, newline="") as f:
+            for row in csv.DictReader(f):
+                runs.append({
+                    "workload": row["workload"],
+                    "smokewagon": row["smokewagon"].lower() == "true",
+                    "threads": int(row["threads"]),
+                    "threads_per_cpu": int(row["threads_per_cpu"]),
+                    "placement": row["placement"],
+                    "pages": int(row["pages"]),
+                    "workers": row.get("workers", "threads"),
+                    "backing_fs": row.get("backing_fs", ""),
+                    "file_mib": int(row.get("file_mib") or DRIVER_FILE_MIB),
+                    "duration_s": int(row["duration_s"]),
+                    "kernel_hash": row["kernel_hash"],
+                    "loops_per_sec": float(row["loops_per_sec"]),
+                    "errors": int(row.get("errors") or 0),
+                    "jittery_cpus": row.get("jittery_cpus", ""),
+                })
+    return runs
+
+
+def mann_whitney(a, b):
+    """two-sided p-value for a and b coming from the same distribution"""
+    n1, n2 = len(a), len(b)
+    ranked = sorted([(v, 0) for v in a] + [(v, 1) for v in b])
+    ranks = [0.0] * len(ranked)
+    ties = []
+    i = 0
+    while i < len(ranked):
+        j = i
+        while j + 1 < len(ranked) and ranked[j + 1][0] == ranked[i][0]:
+            j += 1
+        for k in range(i, j + 1):
+            ranks[k] = (i + j) / 2 + 1
+        ties.append(j - i + 1)
+        i = j + 1
+    u = sum(r for r, (_, side) in zip(ranks, ranked) if side == 0) - n1 * (n1 + 1) / 2
+    u = min(u, n1 * n2 - u)
+
+    # small and untied: count exactly how many of the C(n1+n2, n1) rankings give a U this extreme
+    if n1 + n2 <= 20 and all(t == 1 for t in ties):
+        # ways[n][m][u]: rankings of n a's and m b's with U == u
+        ways = [[None] * (n2 + 1) for _ in range(n1 + 1)]
+        for n in range(n1 + 1):
+            for m in range(n2 + 1):
+                if n == 0 or m == 0:
+                    ways[n][m] = [1]
+                    continue
+                # the largest value is either an a (beating all m b's) or a b
+                take_a = [0] * m + ways[n - 1][m]
+                take_b = ways[n][m - 1]
+                size = max(len(take_a), len(take_b))
+                ways[n][m] = [(take_a[k] if k < len(take_a) else 0) + (take_b[k] if k < len(take_b) else 0) for k in range(size)]
+        counts = ways[n1][n2]
+        tail = sum(counts[k] for k in range(len(counts)) if k <= u)
+        return min(1.0, 2 * tail / math.comb(n1 + n2, n1))
+
+    # otherwise the normal approximation, with the tie correction
+    n = n1 + n2
+    variance = n1 * n2 / 12 * ((n + 1) - sum(t ** 3 - t for t in ties) / (n * (n - 1)))
+    if variance <= 0:
+        return 1.0
+    z = (abs(u - n1 * n2 / 2) - 0.5) / math.sqrt(variance)
+    return min(1.0, math.erfc(max(z, 0) / math.sqrt(2)))
+
+
+def bootstrap(a, b, alpha, rounds=10000, seed=0):
+    """confidence interval for median(b) / median(a)"""
+    rng = random.Random(seed)
+    ratios = []
+    for _ in range(rounds):
+        ma = statistics.median(rng.choices(a, k=len(a)))
+        mb = statistics.median(rng.choices(b, k=len(b)))
+        if ma > 0:
+            ratios.append(mb / ma)
+    ratios.sort()
+    if not ratios:
+        return (math.nan, math.nan)
+    return (ratios[int(alpha / 2 * len(ratios))], ratios[min(len(ratios) - 1, int((1 - alpha / 2) * len(ratios)))])
+
+
+def fail(message):
+    # 1 means a regression, so anything else that goes wrong is 2
+    print(message, file=sys.stderr)
+    sys.exit(2)
+
+
+def pick_kernel(kernels, name):
+    matches = [k for k in kernels if k.startswith(name)]
+    if len(matches) != 1:
+        fail(f"-b {name} matches {len(matches)} of the kernels: {', '.join(kernels)}")
+    return matches[0]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("datasets", nargs="+", help="result-sweep-*.csv or driver *.jsonl files")
+    parser.add_argument("-b", "--baseline", help="baseline kernel hash, or a prefix of it (default: the first kernel seen)")
+    parser.add_argument("-t", "--threshold", type=float, default=0.05, help="slowdown that counts as a regression (default 0.05)")
+    parser.add_argument("-a", "--alpha", type=float, default=0.05, help="significance level (default 0.05)")
+    parser.add_argument("--test", choices=["mannwhitney", "bootstrap"], default="mannwhitney")
+    parser.add_argument("-w", "--where", action="append", default=[], metavar="KEY=VALUE",
+                        help="only cells with this config, e.g. -w workload=mmap-membacked -w smokewagon=true")
+    parser.add_argument("-r", "--regressions", action="store_true", help="only print regressed cells")
+    parser.add_argument("-k", "--keep-suspect", action="store_true", help="keep runs with errors or on jittery cpus")
+    opts = parser.parse_args()
+
+    runs = []
+    for path in opts.datasets:
+        runs.extend(load(path))
+    for where in opts.where:
+        k, _, v = where.partition("=")
+        if k not in CONFIG:
+            fail(f"-w {where}: {k} isn't one of {', '.join(CONFIG)}")
+        runs = [r for r in runs if str(r[k]).lower() == v.lower()]
+    suspect = [r for r in runs if r["errors"] or r["jittery_cpus"]]
+    if suspect and not opts.keep_suspect:
+        runs = [r for r in runs if not (r["errors"] or r["jittery_cpus"])]
+        print(f"left out {len(suspect)} runs with errors or on jittery cpus, -k keeps them")
+
+    kernels = list(dict.fromkeys(r["kernel_hash"] for r in runs))
+    if len(kernels) < 2:
+        fail(f"need runs from at least two kernels to compare, found {len(kernels)}")
+    baseline = pick_kernel(kernels, opts.baseline) if opts.baseline else kernels[0]
+    candidates = [k for k in kernels if k != baseline]
+
+    cells = defaultdict(lambda: defaultdict(list))
+    for r in runs:
+        cells[tuple(r[k] for k in CONFIG)][r["kernel_hash"]].append(r["loops_per_sec"])
+
+    header = ["kernel", "workload", "sw", "thr", "tpc", "place", "pages", "workers", "mib", "n", "base/s", "cand/s", "base ns", "cand ns", "speedup",
+              "p" if opts.test == "mannwhitney" else "ci", "verdict"]
+    rows = []
+    regressions = 0
+    unmatched = 0
+    for cell in sorted(cells):
+        config = dict(zip(CONFIG, cell))
+        base = cells[cell].get(baseline)
+        for kernel in candidates:
+            cand = cells[cell].get(kernel)
+            if not base or not cand:
+                unmatched += 1
+                continue
+            base_median = statistics.median(base)
+            cand_median = statistics.median(cand)
+            speedup = cand_median / base_median if base_median else math.nan
+            if opts.test == "mannwhitney":
+                p = mann_whitney(base, cand)
+                significant = p < opts.alpha
+                stat = f"{p:.3f}"
+            else:
+                low, high = bootstrap(base, cand, opts.alpha)
+                significant = high < 1 or low > 1
+                stat = f"{low:.3f}-{high:.3f}"
+
+            if significant and speedup < 1 - opts.threshold:
+                verdict = "REGRESSION"
+                regressions += 1
+            elif significant and speedup > 1 + opts.threshold:
+                verdict = "faster"
+            else:
+                verdict = "same"
+            if opts.regressions and verdict != "REGRESSION":
+                continue
+
+            # ns per op per thread
+            ns = lambda per_sec: config["threads"] * 1e9 / per_sec if per_sec else math.nan
+            rows.append([kernel[:12], config["workload"], "on" if config["smokewagon"] else "off", config["threads"],
+                         config["threads_per_cpu"], config["placement"], config["pages"], config["workers"], config["file_mib"], f"{len(base)}/{len(cand)}",
+                         f"{base_median:.0f}", f"{cand_median:.0f}", f"{ns(base_median):.0f}", f"{ns(cand_median):.0f}",
+                         f"{speedup:.3f}", stat, verdict])
+
+    print(f"baseline {baseline}, {len(candidates)} candidate(s), {opts.test}, regression past {opts.threshold:.0%} at alpha {opts.alpha}")
+    widths = [max(len(str(x)) for x in column) for column in zip(header, *rows)]
+    for row in [header] + rows:
+        print("  ".join(str(x).rjust(w) for x, w in zip(row, widths)))
+    if unmatched:
+        print(f"{unmatched} cell/kernel pairs had no runs to compare against")
+    print(f"{regressions} regression(s)")
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,614 @@
+/* exercise-stress.c - threads randomly mmap, munmap, mprotect, madvise, mremap and fork over shared
+ * slots of memory, and check every page they read against the stamp it should carry
+ *
+ * the arena is split into -n slots, each with two windows of -p pages. any thread can change any
+ * slot (under the slot's lock) or read it (without). every page of a mapped slot starts with a
+ * stamp of the slot, its generation and the page number, and every rewrite bumps the generation.
+ * readers use the slot's sequence count like a seqlock: a read that raced with a change says
+ * nothing, but a read of a slot nobody touched since it was last changed must see the current
+ * stamp. the stale TLB bugs show up that way: the old page's contents after a munmap, remap, or
+ * DONTNEED; a write that gets through after mprotect(PROT_READ); or a parent's write after fork
+ * that lands in the child's copy.
+ *
+ * slots are MAP_PRIVATE or MAP_SHARED at random every time they're mapped, with MAP_PRIVATE_TLB
+ * under -s, and madvise covers DONTNEED and 26/27 (MADV_PRIVATE_TLB/MADV_NORMAL_TLB, counted as
+ * unsupported where the kernel says EINVAL).
+ *
+ * every thread draws its ops from its own generator seeded from -S and its tid, and every failure
+ * prints the seed, tid and op number. rerunning with the same -S and -t draws the same op sequence
+ * per thread, and with -t 1 the same sequence overall. runs are timed by -d, though, so a rerun only
+ * reaches the same op if it gets as far. reports ops per second by op.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>     // for PATH_MAX
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>     // getopt guide: https://azrael.digipen.edu/~mmead/www/mg/getopt/index.html
+#include <ctype.h>      // for isdigit()
+#include <sched.h>
+#include <sys/utsname.h> // for uname syscall
+
+#define PAGE_SIZE   4096
+#define MAP_PRIVATE_TLB 0x200000
+#define MADV_PRIVATE_TLB 26
+#define MADV_NORMAL_TLB 27
+#define MAX_PRINTED 10              // errors printed per thread, the rest are only counted
+
+enum op {
+    READ,                           // lockless: check a page's stamp
+    PROBE,                          // lockless: write a page back to itself, which must fault if read only
+    RESTAMP,                        // rewrite every page with a new generation
+    MAP,                            // mmap an empty slot, munmap a mapped one
+    PROTECT,                        // flip between read only and read write
+    ADVISE,                         // DONTNEED, 26 or 27
+    REMAP,                          // move to the other window or resize in place
+    FORK,
+    NR_OPS,
+};
+
+const char* op_names[NR_OPS] = { "read", "probe", "restamp", "mmap/munmap", "mprotect", "madvise", "mremap", "fork" };
+const int op_weights[NR_OPS] = { 400, 100, 150, 100, 80, 80, 80, 2 };  // out of 992
+
+struct __attribute__ ((aligned (64))) slot {
+    pthread_mutex_t lock;
+    unsigned long seq;              // odd while the slot is being changed
+    char* windows[2];
+    int window;                     // which window it's mapped in
+    long pages;                     // 0 when unmapped
+    bool shared;
+    int prot;
+    unsigned long gen;
+};
+
+struct __attribute__ ((aligned (64))) per_thread_info {
+    int tid;
+    pthread_t thread;
+    pthread_attr_t attr;
+    cpu_set_t cpuset;
+    unsigned long rng;
+    unsigned long op;               // how many ops it has drawn, to find a failure again
+    unsigned long first_error_op;   // the op that first went wrong, 0 if none did
+    unsigned long counts[NR_OPS];
+    unsigned long errors;
+    unsigned long unsupported;      // madvise 26/27 with EINVAL
+    volatile int* mailbox;          // shared with forked children
+};
+
+long threads = 8;
+long duration = 5;
+long nr_slots = 64;
+long max_pages = 16;
+unsigned long seed;
+long end;
+struct slot* slots;
+pthread_barrier_t barrier;
+
+bool smokewagon = false;
+
+static __thread sigjmp_buf fault_jmp;
+static __thread volatile bool probing;
+
+static long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+// xorshift64*, one per thread so each thread's ops only depend on -S and its tid
+static unsigned long next_random(struct per_thread_info* my_info) {
+    my_info->rng ^= my_info->rng >> 12;
+    my_info->rng ^= my_info->rng << 25;
+    my_info->rng ^= my_info->rng >> 27;
+    return my_info->rng * 0x2545f4914f6cdd1dUL;
+}
+
+static unsigned long stamp(long slot, unsigned long gen, long page) {
+    return ((unsigned long) slot << 48) ^ ((gen & 0xffffffff) << 16) ^ page;
+}
+
+static unsigned long* page_of(struct slot* s, long page) {
+    return (unsigned long*) (s->windows[s->window] + page * PAGE_SIZE);
+}
+
+static void report(struct per_thread_info* my_info, const char* what, long slot, long page, unsigned long found, unsigned long expected) {
+    my_info->errors++;
+    if (my_info->errors <= MAX_PRINTED) {
+        printf("uhoh, seed %lu tid %d op %lu: %s, slot %ld page %ld reads %lx instead of %lx\n",
+            seed, my_info->tid, my_info->op, what, slot, page, found, expected);
+    }
+}
+
+static void fault_handler(int sig) {
+    if (probing) {
+        siglongjmp(fault_jmp, 1);
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// the slot's lock is held for these, and the sequence count makes readers ignore what they saw meanwhile
+static void begin_change(struct slot* s) {
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void end_change(struct slot* s) {
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+// every page below pages must carry the slot's current stamp, or zero after a private DONTNEED
+static void check_slot(struct per_thread_info* my_info, long slot, long pages, bool zeroed, const char* what) {
+    struct slot* s = &slots[slot];
+    for (long p = 0; p < pages; p++) {
+        unsigned long expected = zeroed ? 0 : stamp(slot, s->gen, p);
+        if (*page_of(s, p) != expected) {
+            report(my_info, what, slot, p, *page_of(s, p), expected);
+        }
+    }
+}
+
+static bool make_writable(struct per_thread_info* my_info, long slot) {
+    struct slot* s = &slots[slot];
+    if (s->prot & PROT_WRITE) return true;
+    if (mprotect(s->windows[s->window], s->pages * PAGE_SIZE, PROT_READ|PROT_WRITE)) {
+        printf("uhoh, seed %lu tid %d op %lu: mprotect of slot %ld failed: %s\n", seed, my_info->tid, my_info->op, slot, strerror(errno));
+        my_info->errors++;
+        return false;
+    }
+    s->prot = PROT_READ|PROT_WRITE;
+    return true;
+}
+
+static void restamp(struct per_thread_info* my_info, long slot) {
+    struct slot* s = &slots[slot];
+    if (!make_writable(my_info, slot)) return;
+    s->gen++;
+    for (long p = 0; p < s->pages; p++) {
+        *page_of(s, p) = stamp(slot, s->gen, p);
+    }
+}
+
+static void do_read(struct per_thread_info* my_info, long slot, bool probe) {
+    struct slot* s = &slots[slot];
+    unsigned long seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) return;
+
+    long pages = __atomic_load_n(&s->pages, __ATOMIC_RELAXED);
+    int window = __atomic_load_n(&s->window, __ATOMIC_RELAXED);
+    int prot = __atomic_load_n(&s->prot, __ATOMIC_RELAXED);
+    unsigned long gen = __atomic_load_n(&s->gen, __ATOMIC_RELAXED);
+    if (!pages) return;
+    long page = next_random(my_info) % pages;
+    unsigned long* ptr = (unsigned long*) (s->windows[window] + page * PAGE_SIZE);
+
+    volatile unsigned long found = 0;
+    volatile bool faulted = false;
+    probing = true;
+    if (sigsetjmp(fault_jmp, 1)) {
+        faulted = true;
+    } else {
+        found = __atomic_load_n(ptr, __ATOMIC_RELAXED);
+        if (probe) {
+            // a locked add of 0 is a write that changes nothing
+            __atomic_fetch_add(ptr, 0, __ATOMIC_RELAXED);
+        }
+    }
+    probing = false;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq) return;
+
+    bool read_only = !(prot & PROT_WRITE);
+    if (faulted && !(probe && read_only)) {
+        report(my_info, "faulted on a mapped page", slot, page, 0, stamp(slot, gen, page));
+    } else if (probe && read_only && !faulted) {
+        report(my_info, "wrote through a read only mapping", slot, page, found, stamp(slot, gen, page));
+    } else if (!faulted && found != stamp(slot, gen, page)) {
+        report(my_info, "stale read", slot, page, found, stamp(slot, gen, page));
+    }
+}
+
+static void do_map(struct per_thread_info* my_info, long slot) {
+    struct slot* s = &slots[slot];
+    if (s->pages) {
+        check_slot(my_info, slot, s->pages, false, "before munmap");
+        if (munmap(s->windows[s->window], s->pages * PAGE_SIZE)) {
+            printf("uhoh, seed %lu tid %d op %lu: munmap of slot %ld failed: %s\n", seed, my_info->tid, my_info->op, slot, strerror(errno));
+            my_info->errors++;
+        }
+        s->pages = 0;
+        return;
+    }
+
+    long pages = 1 + next_random(my_info) % max_pages;
+    bool shared = next_random(my_info) & 1;
+    int flags = MAP_FIXED_NOREPLACE | MAP_ANONYMOUS | (shared ? MAP_SHARED : MAP_PRIVATE) | (smokewagon ? MAP_PRIVATE_TLB : 0);
+    char* ptr = mmap(s->windows[s->window], pages * PAGE_SIZE, PROT_READ|PROT_WRITE, flags, -1, 0);
+    if (ptr != s->windows[s->window]) {
+        printf("uhoh, seed %lu tid %d op %lu: mmap of slot %ld failed: %s\n", seed, my_info->tid, my_info->op, slot,
+            ptr == MAP_FAILED ? strerror(errno) : "wrong address");
+        my_info->errors++;
+        if (ptr != MAP_FAILED) munmap(ptr, pages * PAGE_SIZE);
+        return;
+    }
+    s->pages = pages;
+    s->shared = shared;
+    s->prot = PROT_READ|PROT_WRITE;
+    check_slot(my_info, slot, pages, true, "fresh mmap isn't zeroed");
+    restamp(my_info, slot);
+}
+
+static void do_protect(struct per_thread_info* my_info, long slot) {
+    struct slot* s = &slots[slot];
+    if (s->prot & PROT_WRITE) {
+        if (mprotect(s->windows[s->window], s->pages * PAGE_SIZE, PROT_READ)) {
+            printf("uhoh, seed %lu tid %d op %lu: mprotect of slot %ld failed: %s\n", seed, my_info->tid, my_info->op, slot, strerror(errno));
+            my_info->errors++;
+            return;
+        }
+        s->prot = PROT_READ;
+    } else {
+        make_writable(my_info, slot);
+    }
+    check_slot(my_info, slot, s->pages, false, "after mprotect");
+}
+
+static void do_advise(struct per_thread_info* my_info, long slot) {
+    struct slot* s = &slots[slot];
+    const int advice[] = { MADV_DONTNEED, MADV_PRIVATE_TLB, MADV_NORMAL_TLB };
+    int a = advice[next_random(my_info) % 3];
+
+    if (madvise(s->windows[s->window], s->pages * PAGE_SIZE, a)) {
+        if (errno == EINVAL && a != MADV_DONTNEED) {
+            my_info->unsupported++;
+        } else {
+            printf("uhoh, seed %lu tid %d op %lu: madvise(%d) of slot %ld failed: %s\n", seed, my_info->tid, my_info->op, a, slot, strerror(errno));
+            my_info->errors++;
+        }
+        return;
+    }
+    // private pages come back zeroed, shared ones keep their contents
+    check_slot(my_info, slot, s->pages, a == MADV_DONTNEED && !s->shared, "after madvise");
+    if (a == MADV_DONTNEED) restamp(my_info, slot);
+}
+
+static void do_remap(struct per_thread_info* my_info, long slot) {
+    struct slot* s = &slots[slot];
+    char* from = s->windows[s->window];
+    long pages = s->pages;
+    char* ptr;
+
+    if (next_random(my_info) & 1) {
+        char* to = s->windows[!s->window];
+        ptr = mremap(from, pages * PAGE_SIZE, pages * PAGE_SIZE, MREMAP_MAYMOVE|MREMAP_FIXED, to);
+        if (ptr == to) s->window = !s->window;
+    } else {
+        // windows are -p pages, so there's always room to grow in place. shared slots can only
+        // shrink, growing one past its shmem object would just SIGBUS
+        long new_pages = 1 + next_random(my_info) % (s->shared ? pages : max_pages);
+        ptr = mremap(from, pages * PAGE_SIZE, new_pages * PAGE_SIZE, 0);
+        if (ptr == from) s->pages = new_pages;
+    }
+    if (ptr == MAP_FAILED) {
+        printf("uhoh, seed %lu tid %d op %lu: mremap of slot %ld failed: %s\n", seed, my_info->tid, my_info->op, slot, strerror(errno));
+        my_info->errors++;
+        return;
+    }
+
+    // what was there must have come along, and anything new is zero
+    check_slot(my_info, slot, pages < s->pages ? pages : s->pages, false, "after mremap");
+    for (long p = pages; p < s->pages; p++) {
+        if (*page_of(s, p) != 0) report(my_info, "mremap grew into old contents", slot, p, *page_of(s, p), 0);
+    }
+    restamp(my_info, slot);
+}
+
+// wait, a second at most, for the other side of a fork to get to step
+static void wait_mailbox(volatile int* mailbox, int step) {
+    long deadline = now_ns() + 1000000000L;
+    while (__atomic_load_n(mailbox, __ATOMIC_ACQUIRE) < step && now_ns() < deadline) {
+        sched_yield();
+    }
+}
+
+// the child checks the slot as it was at fork, then the parent restamps it: the child's private
+// copy must keep the old stamps and a shared slot must show the new ones. then the child scribbles
+// on a private slot, which the parent mustn't see. no printf in the child, it says what went wrong
+// in its exit status.
+static void do_fork(struct per_thread_info* my_info, long slot) {
+    struct slot* s = &slots[slot];
+    begin_change(s);
+    bool writable = make_writable(my_info, slot);
+    end_change(s);
+    if (!writable) return;
+    unsigned long gen = s->gen;
+    *my_info->mailbox = 0;
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        printf("uhoh, seed %lu tid %d op %lu: fork failed: %s\n", seed, my_info->tid, my_info->op, strerror(errno));
+        my_info->errors++;
+        return;
+    }
+    if (pid == 0) {
+        int status = 0;
+        for (long p = 0; p < s->pages; p++) {
+            if (*page_of(s, p) != stamp(slot, gen, p)) status |= 1;
+        }
+        __atomic_store_n(my_info->mailbox, 1, __ATOMIC_RELEASE);
+        wait_mailbox(my_info->mailbox, 2);
+        unsigned long expected = s->shared ? gen + 1 : gen;
+        for (long p = 0; p < s->pages; p++) {
+            if (*page_of(s, p) != stamp(slot, expected, p)) status |= 2;
+        }
+        if (!s->shared) {
+            *page_of(s, 0) = 0xdead;
+        }
+        _exit(status);
+    }
+
+    wait_mailbox(my_info->mailbox, 1);
+    begin_change(s);
+    restamp(my_info, slot);
+    end_change(s);
+    __atomic_store_n(my_info->mailbox, 2, __ATOMIC_RELEASE);
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+        printf("uhoh, seed %lu tid %d op %lu: forked child for slot %ld didn't exit normally\n", seed, my_info->tid, my_info->op, slot);
+        my_info->errors++;
+    } else if (WEXITSTATUS(status)) {
+        printf("uhoh, seed %lu tid %d op %lu: forked child found %s%s in %s slot %ld\n", seed, my_info->tid, my_info->op,
+            WEXITSTATUS(status) & 1 ? "the wrong stamps at fork" : "",
+            WEXITSTATUS(status) & 2 ? " the parent's later stamps (or missed them, if shared)" : "",
+            s->shared ? "shared" : "private", slot);
+        my_info->errors++;
+    }
+    check_slot(my_info, slot, s->pages, false, "after fork");
+}
+
+void* test_smokewagon(void* info_ptr) {
+    struct per_thread_info* my_info = info_ptr;
+
+    pthread_barrier_wait(&barrier);
+    do {
+        if (my_info->errors && !my_info->first_error_op) my_info->first_error_op = my_info->op;
+
+        unsigned long r = next_random(my_info);
+        long slot = (r >> 32) % nr_slots;
+        int pick = r % 992;
+        enum op op = 0;
+        while (pick >= op_weights[op]) {
+            pick -= op_weights[op];
+            op++;
+        }
+        my_info->op++;
+
+        if (op == READ || op == PROBE) {
+            do_read(my_info, slot, op == PROBE);
+            my_info->counts[op]++;
+            continue;
+        }
+
+        struct slot* s = &slots[slot];
+        pthread_mutex_lock(&s->lock);
+        // an empty slot can only be mapped
+        if (!s->pages) op = MAP;
+        if (op != FORK) begin_change(s);
+        switch (op) {
+            case RESTAMP: restamp(my_info, slot); break;
+            case MAP: do_map(my_info, slot); break;
+            case PROTECT: do_protect(my_info, slot); break;
+            case ADVISE: do_advise(my_info, slot); break;
+            case REMAP: do_remap(my_info, slot); break;
+            case FORK: do_fork(my_info, slot); break;
+            default: break;
+        }
+        if (op != FORK) end_change(s);
+        pthread_mutex_unlock(&s->lock);
+        my_info->counts[op]++;
+    } while (end > now_ns());
+    if (my_info->errors && !my_info->first_error_op) my_info->first_error_op = my_info->op;
+
+    return info_ptr;
+}
+
+int main(int argc, char *argv[]) {
+    seed = time(NULL);
+
+    // check opts
+    int opt;
+    while ((opt = getopt(argc, argv, "st:d:n:p:S:")) != -1) {
+        switch(opt) {
+            case 't':
+            case 'd':
+            case 'n':
+            case 'p':
+            case 'S':
+                for (char *p = optarg; *p; p++) {
+                    if (!isdigit(*p)) {
+                        printf("Error: -%c requires a positive integer\n", opt);
+                        return EXIT_FAILURE;
+                    }
+                }
+                if (opt == 't') {
+                    threads = atol(optarg);
+                } else if (opt == 'd') {
+                    duration = atol(optarg);
+                } else if (opt == 'n') {
+                    nr_slots = atol(optarg);
+                } else if (opt == 'p') {
+                    max_pages = atol(optarg);
+                } else {
+                    seed = strtoul(optarg, NULL, 10);
+                }
+                break;
+            case 's':
+                smokewagon = true;
+                break;
+        }
+    }
+    if (threads < 1 || nr_slots < 1 || max_pages < 1 || max_pages > 0xffff) {
+        printf("-t, -n and -p must be at least 1, and -p at most 65535\n");
+        return EXIT_FAILURE;
+    }
+
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    printf("VM stress, %ld threads over %ld slots of up to %ld pages for %ld seconds, seed %lu\n\n", threads, nr_slots, max_pages, duration, seed);
+    printf("smokewagon: %s\n\n", smokewagon ? " ON" : "OFF");
+
+    // get and print uname
+    struct utsname u;
+    if (uname(&u) == -1) {
+        perror("uname\n");
+        return EXIT_FAILURE;
+    }
+    printf("running on: %s %s %s %s %s\n",
+        u.sysname,
+        u.nodename,
+        u.release,
+        u.version,
+        u.machine);
+
+    struct sigaction action = { .sa_handler = fault_handler };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, NULL);
+    sigaction(SIGBUS, &action, NULL);
+
+    struct per_thread_info* thread_infos = aligned_alloc(64, threads * sizeof(struct per_thread_info));
+    slots = aligned_alloc(64, nr_slots * sizeof(struct slot));
+    // one mailbox a cache line for each thread's forked children
+    volatile int* mailboxes = mmap(NULL, threads * 64, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (!thread_infos || !slots || mailboxes == MAP_FAILED) {
+        perror("thread state allocation failed");
+        return EXIT_FAILURE;
+    }
+    memset(thread_infos, 0, threads * sizeof(struct per_thread_info));
+    memset(slots, 0, nr_slots * sizeof(struct slot));
+
+    // find room for every window, and give it back once the threads (and their stacks) exist: slots
+    // map into empty space, and nothing else maps memory while the threads run
+    size_t window_size = max_pages * PAGE_SIZE;
+    char* arena = mmap(NULL, 2 * nr_slots * window_size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (arena == MAP_FAILED) {
+        perror("arena reservation failed");
+        return EXIT_FAILURE;
+    }
+    for (long i=0; i<nr_slots; i++) {
+        pthread_mutex_init(&slots[i].lock, NULL);
+        slots[i].windows[0] = arena + 2 * i * window_size;
+        slots[i].windows[1] = arena + (2 * i + 1) * window_size;
+    }
+
+    for (long i=0; i<threads; i++) {
+        thread_infos[i].tid = i;
+        // splitmix64 of the seed and tid, so neighbouring seeds don't give neighbouring streams
+        unsigned long z = seed + (i + 1) * 0x9e3779b97f4a7c15UL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+        thread_infos[i].rng = (z ^ (z >> 31)) | 1;
+        thread_infos[i].mailbox = (volatile int*) ((char*) mailboxes + i * 64);
+        CPU_ZERO(&thread_infos[i].cpuset);
+        CPU_SET(i % nr_cpus, &thread_infos[i].cpuset);
+        pthread_attr_init(&thread_infos[i].attr);
+        pthread_attr_setaffinity_np(&thread_infos[i].attr, sizeof(cpu_set_t), &thread_infos[i].cpuset);
+    }
+
+    printf("\nbegin stressing\n\n");
+    fflush(stdout);
+
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+    for (long i=0; i<threads; i++) {
+        int ret = pthread_create(&thread_infos[i].thread, &thread_infos[i].attr, test_smokewagon, &thread_infos[i]);
+        if (ret) {
+            printf("ERROR: return code for thread %ld from pthread_create() is %d\n", i, ret);
+            return EXIT_FAILURE;
+        }
+    }
+    munmap(arena, 2 * nr_slots * window_size);
+    long begin = now_ns();
+    end = begin + duration * 1000000000L;
+    pthread_barrier_wait(&barrier);
+    for (long i=0; i<threads; i++) {
+        pthread_join(thread_infos[i].thread, NULL);
+    }
+    double seconds = (now_ns() - begin) / 1e9;
+
+    // whatever is still mapped must still be right
+    struct per_thread_info final = { .tid = -1 };
+    for (long i=0; i<nr_slots; i++) {
+        if (slots[i].pages) {
+            check_slot(&final, i, slots[i].pages, false, "at the end");
+            munmap(slots[i].windows[slots[i].window], slots[i].pages * PAGE_SIZE);
+        }
+    }
+
+    unsigned long counts[NR_OPS] = { 0 };
+    unsigned long total = 0, errors = final.errors, unsupported = 0;
+    for (long i=0; i<threads; i++) {
+        for (int o = 0; o < NR_OPS; o++) {
+            counts[o] += thread_infos[i].counts[o];
+            total += thread_infos[i].counts[o];
+        }
+        errors += thread_infos[i].errors;
+        unsupported += thread_infos[i].unsupported;
+        printf("tid %ld performed %lu ops, %lu errors\n", i, thread_infos[i].op, thread_infos[i].errors);
+    }
+
+    printf("\n%12s %12s %12s\n", "op", "count", "ops/s");
+    for (int o = 0; o < NR_OPS; o++) {
+        printf("%12s %12lu %12.0f\n", op_names[o], counts[o], counts[o] / seconds);
+    }
+    printf("%12s %12lu %12.0f\n", "all", total, total / seconds);
+    if (unsupported) {
+        printf("\n%lu madvise 26/27 calls were EINVAL, this kernel doesn't have them\n", unsupported);
+    }
+    printf("\n%lu integrity errors\n", errors);
+    if (errors) {
+        for (long i=0; i<threads; i++) {
+            if (thread_infos[i].first_error_op) {
+                printf("tid %ld first went wrong at op %lu of %lu\n", i, thread_infos[i].first_error_op, thread_infos[i].op);
+            }
+        }
+        printf("reproduce with: %s%s -t %ld -n %ld -p %ld -d %ld -S %lu\n", argv[0], smokewagon ? " -s" : "", threads, nr_slots, max_pages, duration, seed);
+    }
+
+    // output statistics
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "result-exercise-stress-%s-%s.csv", smokewagon ? "smokewagon" : "inactive", u.release);
+
+    printf("opening %s\n", filename);
+    FILE *fptr = fopen(filename, "w");
+    if(fptr == NULL) {
+        perror("file opening error!");
+        return EXIT_FAILURE;
+    }
+
+    fprintf(fptr, "seed,threads,op,count,ops_per_sec,errors\n");
+    for (int o = 0; o < NR_OPS; o++) {
+        fprintf(fptr, "%lu, %ld, %s, %lu, %.0f, %lu\n", seed, threads, op_names[o], counts[o], counts[o] / seconds, errors);
+    }
+    fprintf(fptr, "%lu, %ld, all, %lu, %.0f, %lu\n", seed, threads, total, total / seconds, errors);
+    fclose(fptr);
+    printf("totals written to %s\n", filename);
+
+    for (long i=0; i<threads; i++) {
+        pthread_attr_destroy(&thread_infos[i].attr);
+    }
+    pthread_barrier_destroy(&barrier);
+    free(thread_infos);
+    free(slots);
+
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
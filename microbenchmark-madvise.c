@@ -0,0 +1,277 @@
+/* microbenchmark-madvise.c - cost of flipping a range between MADV_PRIVATE_TLB and MADV_NORMAL_TLB
+ *
+ * the main thread times madvise(26) followed by madvise(27) on one range, over and over, for range
+ * sizes swept by factors of 4 from -z to -Z KiB (4 KiB to 4 GiB by default). each size is run with
+ * the range unpopulated and fully populated, and with -b bystander threads (1 by default, -b 0 for
+ * none) either sleeping or busy writing their own pages in the same mm. TLB shootdown and function call IPIs are read from
+ * /proc/interrupts around each run, so flushes caused by the transitions themselves show up too.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>     // for PATH_MAX
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>     // getopt guide: https://azrael.digipen.edu/~mmead/www/mg/getopt/index.html
+#include <ctype.h>      // for isdigit()
+#include <sched.h>
+#include <sys/utsname.h> // for uname syscall
+
+#define PAGE_SIZE   4096
+#define MADV_PRIVATE_TLB 26
+#define MADV_NORMAL_TLB 27
+
+enum bystander_mode { IDLE, ACTIVE, EXIT };
+
+struct __attribute__ ((aligned (64))) per_thread_info {
+    int tid;
+    pthread_t thread;
+    pthread_attr_t attr;
+    cpu_set_t cpuset;
+    unsigned long counter;
+    unsigned long* my_page;
+};
+
+long bystanders = 1;
+long duration = 5;
+long min_kib = 4;
+long max_kib = 4L * 1024 * 1024;
+long nr_cpus;
+
+_Atomic int mode = IDLE;
+
+static long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+// sum a row of /proc/interrupts across all cpus, picked by a substring of its description,
+// e.g. "TLB shootdowns" on x86 or "Function call interrupts" everywhere
+static unsigned long read_interrupts(const char* name) {
+    FILE* f = fopen("/proc/interrupts", "r");
+    char line[8192];
+    unsigned long total = 0;
+
+    if (!f) return 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (!strstr(line, name)) continue;
+        char* p = strchr(line, ':');
+        if (!p) continue;
+        p++;
+        // the per-cpu counts come first, then the description
+        while (true) {
+            char* endptr;
+            unsigned long n = strtoul(p, &endptr, 10);
+            if (endptr == p) break;
+            total += n;
+            p = endptr;
+        }
+    }
+    fclose(f);
+    return total;
+}
+
+void* bystand(void* info_ptr) {
+    struct per_thread_info* my_info = info_ptr;
+    unsigned long local_counter = 0;
+    struct timespec nap = { .tv_sec = 0, .tv_nsec = 1000000 };
+    int m;
+
+    while ((m = atomic_load_explicit(&mode, memory_order_relaxed)) != EXIT) {
+        if (m == IDLE) {
+            // still part of the mm, but not running on our cpu
+            nanosleep(&nap, NULL);
+        } else {
+            my_info->my_page[local_counter % (PAGE_SIZE/sizeof(unsigned long))] = local_counter;
+            local_counter++;
+        }
+    }
+    my_info->counter = local_counter;
+
+    return info_ptr;
+}
+
+int main(int argc, char *argv[]) {
+    // check opts
+    int opt;
+    while ((opt = getopt(argc, argv, "b:d:z:Z:")) != -1) {
+        switch(opt) {
+            case 'b':
+            case 'd':
+            case 'z':
+            case 'Z':
+                for (char *p = optarg; *p; p++) {
+                    if (!isdigit(*p)) {
+                        printf("Error: -%c requires a positive integer\n", opt);
+                        return EXIT_FAILURE;
+                    }
+                }
+                if (opt == 'b') {
+                    bystanders = atol(optarg);
+                } else if (opt == 'd') {
+                    duration = atoi(optarg);
+                } else if (opt == 'z') {
+                    min_kib = atol(optarg);
+                } else {
+                    max_kib = atol(optarg);
+                }
+                break;
+        }
+    }
+    if (min_kib < PAGE_SIZE/1024 || min_kib % (PAGE_SIZE/1024) || min_kib > max_kib) {
+        printf("range sizes (-z %ld, -Z %ld) must be whole pages and -z can't be larger than -Z\n", min_kib, max_kib);
+        return EXIT_FAILURE;
+    }
+
+    nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    printf("madvise() transition microbenchmark, testing %ld KiB to %ld KiB ranges with %ld bystanders for %ld seconds each\n\n", min_kib, max_kib, bystanders, duration);
+
+    // get and print uname
+    struct utsname u;
+    if (uname(&u) == -1) {
+        perror("uname\n");
+        return EXIT_FAILURE;
+    }
+    printf("running on: %s %s %s %s %s\n",
+        u.sysname,
+        u.nodename,
+        u.release,
+        u.version,
+        u.machine);
+
+    // main thread on cpu 0, bystanders on the cpus after it
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(0, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+
+    struct per_thread_info* bystander_infos = aligned_alloc(64, (bystanders + 1) * sizeof(struct per_thread_info));
+    if (!bystander_infos) {
+        perror("thread state allocation failed");
+        return EXIT_FAILURE;
+    }
+    memset(bystander_infos, 0, (bystanders + 1) * sizeof(struct per_thread_info));
+    for (long i=0; i<bystanders; i++) {
+        bystander_infos[i].tid = i + 1;
+        bystander_infos[i].my_page = mmap(NULL, PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (bystander_infos[i].my_page == MAP_FAILED) {
+            printf("bystander mmap() failed: %s\n", strerror(errno));
+            return -1;
+        }
+        CPU_ZERO(&bystander_infos[i].cpuset);
+        CPU_SET((i + 1) % nr_cpus, &bystander_infos[i].cpuset);
+        pthread_attr_init(&bystander_infos[i].attr);
+        pthread_attr_setaffinity_np(&bystander_infos[i].attr, sizeof(cpu_set_t), &bystander_infos[i].cpuset);
+        int ret = pthread_create(&bystander_infos[i].thread, &bystander_infos[i].attr, bystand, &bystander_infos[i]);
+        if (ret) printf("ERROR: return code for bystander %ld from pthread_create() is %d\n", i, ret);
+    }
+
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "result-microbenchmark-madvise-%s.csv", u.release);
+    printf("opening %s\n", filename);
+    FILE *fptr = fopen(filename, "w");
+    if(fptr == NULL) {
+        perror("file opening error!");
+        return EXIT_FAILURE;
+    }
+    fprintf(fptr, "size_kib,populated,bystanders,toggles,private_ns,normal_ns,private_ns_per_page,normal_ns_per_page,tlb_ipis_per_toggle,call_ipis_per_toggle\n");
+
+    printf("\nbegin benchmarking\n\n");
+
+    for (long kib = min_kib; kib <= max_kib; kib *= 4) {
+        size_t size = kib * 1024;
+        size_t pages = size / PAGE_SIZE;
+
+        for (int populated=0; populated<2; populated++) {
+        for (int active=0; active<(bystanders ? 2 : 1); active++) {
+            char* range = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+            if (range == MAP_FAILED) {
+                printf("range mmap() of %ld KiB failed: %s\n", kib, strerror(errno));
+                return -1;
+            }
+            if (populated) {
+                for (size_t p=0; p<pages; p++) {
+                    range[p * PAGE_SIZE] = 'x';
+                }
+            }
+
+            atomic_store(&mode, active ? ACTIVE : IDLE);
+            const char* bystander_state = bystanders ? (active ? "active" : "idle") : "none";
+
+            printf("Running madvise toggle loop on %ld KiB %s range with %s bystanders for %ld seconds:\n",
+                kib, populated ? "populated" : "unpopulated", bystander_state, duration);
+
+            unsigned long toggles = 0;
+            unsigned long private_ns = 0;
+            unsigned long normal_ns = 0;
+            unsigned long tlb_before = read_interrupts("TLB");
+            unsigned long call_before = read_interrupts("Function call");
+            long end = now_ns() + duration * 1000000000L;
+            long now;
+
+            do {
+                long t0 = now_ns();
+                if (madvise(range, size, MADV_PRIVATE_TLB)) {
+                    printf("madvise(MADV_PRIVATE_TLB) failed: %s, is this a smokewagon kernel?\n", strerror(errno));
+                    return EXIT_FAILURE;
+                }
+                long t1 = now_ns();
+                if (madvise(range, size, MADV_NORMAL_TLB)) {
+                    printf("madvise(MADV_NORMAL_TLB) failed: %s\n", strerror(errno));
+                    return EXIT_FAILURE;
+                }
+                now = now_ns();
+                private_ns += t1 - t0;
+                normal_ns += now - t1;
+                toggles++;
+            } while (end > now);
+
+            unsigned long tlb_ipis = read_interrupts("TLB") - tlb_before;
+            unsigned long call_ipis = read_interrupts("Function call") - call_before;
+
+            if (populated) {
+                // the range must have survived being flipped back and forth
+                for (size_t p=0; p<pages; p++) {
+                    if (range[p * PAGE_SIZE] != 'x') {
+                        printf("uhoh, page %zu of the range reads '%c' instead of 'x'\n", p, range[p * PAGE_SIZE]);
+                        return EXIT_FAILURE;
+                    }
+                }
+            }
+            munmap(range, size);
+
+            printf("%lu toggles, MADV_PRIVATE_TLB avg %lu ns (%.2f ns/page), MADV_NORMAL_TLB avg %lu ns (%.2f ns/page), %.3f TLB and %.3f call IPIs per toggle.\n\n",
+                toggles, private_ns / toggles, (double) private_ns / toggles / pages, normal_ns / toggles, (double) normal_ns / toggles / pages,
+                (double) tlb_ipis / toggles, (double) call_ipis / toggles);
+            fprintf(fptr, "%ld, %d, %s, %lu, %lu, %lu, %.3f, %.3f, %.3f, %.3f\n", kib, populated, bystander_state, toggles,
+                private_ns / toggles, normal_ns / toggles, (double) private_ns / toggles / pages, (double) normal_ns / toggles / pages,
+                (double) tlb_ipis / toggles, (double) call_ipis / toggles);
+            fflush(fptr);
+        }
+        }
+    }
+
+    printf("microbenchmarking complete\n");
+
+    atomic_store(&mode, EXIT);
+    for (long i=0; i<bystanders; i++) {
+        pthread_join(bystander_infos[i].thread, NULL);
+        pthread_attr_destroy(&bystander_infos[i].attr);
+        munmap(bystander_infos[i].my_page, PAGE_SIZE);
+    }
+    free(bystander_infos);
+
+    fclose(fptr);
+    printf("totals written to %s\n", filename);
+
+    return EXIT_SUCCESS;
+}
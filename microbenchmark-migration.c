@@ -0,0 +1,463 @@
+/* microbenchmark-migration.c - context-switch and migration cost for private-TLB pages
+ *
+ * pingpong: 2..t threads share one cpu and hand a token around through per-thread futexes.
+ *           each handoff is timed from the waker's futex_wake() to the wakee returning from
+ *           futex_wait(), and each thread checks its own page still holds the stamp it wrote.
+ * migrate:  1..t threads each map-check-write-unmap their own page, and every -i microseconds
+ *           re-pin themselves to the next cpu with sched_setaffinity(). a freshly mapped anonymous
+ *           page must read zero, so a stale stamp means some cpu kept a translation it shouldn't have.
+ *           each thread also stamps its bystander page, which stays mapped, right before every
+ *           migration and checks the stamp is still there once it's running on the new cpu.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>     // for ULONG_MAX, PATH_MAX
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>     // getopt guide: https://azrael.digipen.edu/~mmead/www/mg/getopt/index.html
+#include <ctype.h>      // for isdigit()
+#include <sched.h>
+#include <sys/utsname.h> // for uname syscall
+
+#define ONE_GB_SIZE (1ULL << 30)
+#define PAGE_SIZE   4096
+#define MAP_PRIVATE_TLB 0x200000
+
+struct __attribute__ ((aligned (64))) per_thread_info {
+    int tid;
+    pthread_t thread;
+    pthread_attr_t attr;
+    cpu_set_t cpuset;
+    _Atomic uint32_t go;            // pingpong: futex word, 1 when it's our turn
+    unsigned long counter;          // pingpong: switches into this thread, migrate: map-write-unmap loops
+    unsigned long migrations;
+    unsigned long errors;
+    unsigned long total_ns;         // summed switch or migration latency
+    unsigned long min_ns;
+    unsigned long max_ns;
+    unsigned long* my_page;
+    unsigned long* bystander_page;
+    bool created;                   // pthread_create() worked, so there's something to join
+};
+
+struct per_thread_info* thread_infos;
+
+long threads = 4;
+long duration = 5;
+long interval = 1000;               // microseconds between migrations
+long pingpong_cpu = 0;
+long ring_threads;                  // how many threads the pingpong token is passed around
+long nr_cpus;
+long end;
+
+int mmap_flags = MAP_SHARED|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE;
+bool smokewagon = false;
+bool run_pingpong = true;
+bool run_migrate = true;
+
+_Atomic long handoff_ns;            // when the token was last passed
+atomic_bool stop;
+
+static long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static long futex(_Atomic uint32_t* uaddr, int op, uint32_t val) {
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+static void record_latency(struct per_thread_info* my_info, unsigned long ns) {
+    my_info->total_ns += ns;
+    if (ns < my_info->min_ns) my_info->min_ns = ns;
+    if (ns > my_info->max_ns) my_info->max_ns = ns;
+}
+
+static void reset_info(struct per_thread_info* my_info) {
+    my_info->go = 0;
+    my_info->counter = 0;
+    my_info->migrations = 0;
+    my_info->errors = 0;
+    my_info->total_ns = 0;
+    my_info->min_ns = ULONG_MAX;
+    my_info->max_ns = 0;
+}
+
+void* pingpong(void* info_ptr) {
+    struct per_thread_info* my_info = info_ptr;
+    struct per_thread_info* next = &thread_infos[(my_info->tid + 1) % ring_threads];
+    unsigned long stamp = 0;
+
+    while (true) {
+        // sleep until the previous thread hands us the token
+        while (atomic_load(&my_info->go) == 0) {
+            futex(&my_info->go, FUTEX_WAIT_PRIVATE, 0);
+        }
+        long handoff = atomic_load(&handoff_ns);
+        if (handoff) record_latency(my_info, now_ns() - handoff);
+        atomic_store(&my_info->go, 0);
+
+        // our page must still hold what we wrote before the other threads ran on this cpu
+        if (my_info->my_page[0] != stamp) {
+            printf("uhoh, tid: %d expected stamp %lu but read %lu\n", my_info->tid, stamp, my_info->my_page[0]);
+            my_info->errors++;
+        }
+        stamp = ((unsigned long) my_info->tid << 48) | ++my_info->counter;
+        my_info->my_page[0] = stamp;
+
+        // thread 0 keeps time, everyone else finds out when the token comes around
+        if (my_info->tid == 0 && now_ns() >= end) {
+            atomic_store(&stop, true);
+        }
+        bool stopping = atomic_load(&stop);
+
+        atomic_store(&handoff_ns, now_ns());
+        atomic_store(&next->go, 1);
+        futex(&next->go, FUTEX_WAKE_PRIVATE, 1);
+
+        if (stopping) break;
+    }
+
+    return info_ptr;
+}
+
+void* migrate(void* info_ptr) {
+    struct per_thread_info* my_info = info_ptr;
+    int tid = my_info->tid;
+    long cpu = tid % nr_cpus;
+    long next_migration = now_ns() + interval * 1000L;
+    long now;
+    cpu_set_t cpuset;
+
+    do {
+        // fresh anonymous page, so anything other than zero is a stale translation
+        unsigned long* ptr = mmap(my_info->my_page, PAGE_SIZE, PROT_READ|PROT_WRITE, mmap_flags, -1, 0);
+        if (ptr == MAP_FAILED) {
+            printf("mmap() for tid: %d failed, ptr == MAP_FAILED: %s\n", tid, strerror(errno));
+            my_info->errors++;
+            return info_ptr;
+        } else if (ptr != my_info->my_page) {
+            printf("mmap() for tid: %d problem, ptr != my_info->my_page\n", tid);
+            my_info->errors++;
+            return info_ptr;
+        }
+        if (ptr[0] != 0) {
+            printf("uhoh, tid: %d read stale stamp %lu from a fresh page on cpu %d\n", tid, ptr[0], sched_getcpu());
+            my_info->errors++;
+        }
+        ptr[0] = ++my_info->counter;
+        munmap(ptr, PAGE_SIZE);
+
+        now = now_ns();
+        if (now >= next_migration) {
+            cpu = (cpu + 1) % nr_cpus;
+            CPU_ZERO(&cpuset);
+            CPU_SET(cpu, &cpuset);
+
+            // written on the old cpu, read back on the new one
+            unsigned long stamp = ((unsigned long) tid << 48) | (my_info->migrations + 1);
+            my_info->bystander_page[0] = stamp;
+
+            // sched_setaffinity() on ourselves doesn't return until we're running on the new cpu
+            long before = now_ns();
+            if (sched_setaffinity(0, sizeof(cpu_set_t), &cpuset)) {
+                printf("sched_setaffinity() for tid: %d to cpu %ld failed: %s\n", tid, cpu, strerror(errno));
+                my_info->errors++;
+                return info_ptr;
+            }
+            now = now_ns();
+            record_latency(my_info, now - before);
+            my_info->migrations++;
+            if (nr_cpus > 1 && sched_getcpu() != cpu) {
+                printf("uhoh, tid: %d asked for cpu %ld but is on cpu %d\n", tid, cpu, sched_getcpu());
+            }
+            if (my_info->bystander_page[0] != stamp) {
+                printf("uhoh, tid: %d expected stamp %lu on its bystander page after migrating to cpu %ld but read %lu\n",
+                    tid, stamp, cpu, my_info->bystander_page[0]);
+                my_info->errors++;
+            }
+            next_migration = now + interval * 1000L;
+        }
+    } while (end > now);
+
+    return info_ptr;
+}
+
+int main(int argc, char *argv[]) {
+    bool failed = false;
+
+    // check opts
+    int opt;
+    while ((opt = getopt(argc, argv, "st:d:i:c:w:")) != -1) {
+        switch(opt) {
+            case 't':
+            case 'd':
+            case 'i':
+            case 'c':
+                for (char *p = optarg; *p; p++) {
+                    if (!isdigit(*p)) {
+                        printf("Error: -%c requires a positive integer\n", opt);
+                        return EXIT_FAILURE;
+                    }
+                }
+                if (opt == 't') {
+                    int opt_threads = atoi(optarg);
+                    if (opt_threads > 0) {
+                        threads = opt_threads;
+                    } else {
+                        printf("Error: -t is %d, but should be at least 1, defaulting to 4\n", opt_threads);
+                    }
+                } else if (opt == 'd') {
+                    duration = atoi(optarg);
+                } else if (opt == 'i') {
+                    interval = atol(optarg);
+                } else {
+                    pingpong_cpu = atol(optarg);
+                }
+                break;
+            case 's':
+                smokewagon = true;
+                break;
+            case 'w':
+                if (!strcmp(optarg, "pingpong")) {
+                    run_migrate = false;
+                } else if (!strcmp(optarg, "migrate")) {
+                    run_pingpong = false;
+                } else {
+                    printf("Error: -w should be pingpong or migrate\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+        }
+    }
+
+    nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (pingpong_cpu >= nr_cpus) {
+        printf("Error: -c is %ld, but only %ld cpus are online\n", pingpong_cpu, nr_cpus);
+        return EXIT_FAILURE;
+    }
+
+    // more threads than cpus is fine: pingpong always shares one cpu, and migrate round-robins
+    thread_infos = aligned_alloc(64, threads * sizeof(struct per_thread_info));
+    unsigned long* switches = calloc(threads, sizeof(unsigned long));
+    unsigned long (*switch_ns)[3] = calloc(threads, sizeof(*switch_ns));         // avg, min, max
+    unsigned long* loops = calloc(threads, sizeof(unsigned long));
+    unsigned long* migrations = calloc(threads, sizeof(unsigned long));
+    unsigned long (*migration_ns)[3] = calloc(threads, sizeof(*migration_ns));   // avg, min, max
+    unsigned long (*errors)[2] = calloc(threads, sizeof(*errors));               // pingpong, migrate
+    if (!thread_infos || !switches || !switch_ns || !loops || !migrations || !migration_ns || !errors) {
+        perror("thread state allocation failed");
+        return EXIT_FAILURE;
+    }
+    memset(thread_infos, 0, threads * sizeof(struct per_thread_info));
+
+    printf("migration microbenchmark, testing up to %ld threads for %ld seconds each\n", threads, duration);
+    printf("pingpong on cpu %ld, migrating every %ld us across %ld cpus\n\n", pingpong_cpu, interval, nr_cpus);
+
+    if (smokewagon) {
+        mmap_flags |= MAP_PRIVATE_TLB;
+        printf("smokewagon:  ON\n\n");
+    } else {
+        printf("smokewagon: OFF\n\n");
+    }
+
+    // get and print uname
+    struct utsname u;
+    if (uname(&u) == -1) {
+        perror("uname\n");
+        return EXIT_FAILURE;
+    }
+    printf("running on: %s %s %s %s %s\n",
+        u.sysname,
+        u.nodename,
+        u.release,
+        u.version,
+        u.machine);
+
+    // same layout as the mmap workloads in microbenchmark.c: a GB-aligned 1 GB region per thread,
+    // with a hole for my_page and a bystander page right after it
+    char* big_mmap_ptr = mmap(NULL, ONE_GB_SIZE*(threads+1), PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (big_mmap_ptr == MAP_FAILED || big_mmap_ptr == NULL) {
+        printf("big mmap failed\n");
+        return -1;
+    }
+    size_t offset_to_unallocated = (uintptr_t) big_mmap_ptr % ONE_GB_SIZE;
+    size_t offset_to_allocated = (ONE_GB_SIZE - offset_to_unallocated) % ONE_GB_SIZE;
+    char* aligned_ptr = big_mmap_ptr + offset_to_allocated;
+
+    for (int i=0; i<threads; i++) {
+        thread_infos[i].tid = i;
+
+        thread_infos[i].my_page = (unsigned long*) aligned_ptr;
+        aligned_ptr += ONE_GB_SIZE;
+        munmap(thread_infos[i].my_page, PAGE_SIZE);
+
+        thread_infos[i].bystander_page = thread_infos[i].my_page + PAGE_SIZE/sizeof(unsigned long);
+        mprotect(thread_infos[i].bystander_page, PAGE_SIZE, PROT_READ|PROT_WRITE);
+        thread_infos[i].bystander_page[0] = 1;
+
+        pthread_attr_init(&thread_infos[i].attr);
+    }
+
+    printf("\nbegin benchmarking\n\n");
+
+    // pingpong needs someone to switch to, so it starts at 2 threads
+    for (long t=1; run_pingpong && t<threads; t++) {
+        long nr = t+1;
+
+        // map each thread's persistent page; it stays mapped for the whole run
+        for (long i=0; i<nr; i++) {
+            unsigned long* ptr = mmap(thread_infos[i].my_page, PAGE_SIZE, PROT_READ|PROT_WRITE, mmap_flags, -1, 0);
+            if (ptr != thread_infos[i].my_page) {
+                printf("mmap() for tid: %ld failed: %s\n", i, strerror(errno));
+                return -1;
+            }
+            ptr[0] = 0;
+            reset_info(&thread_infos[i]);
+
+            CPU_ZERO(&thread_infos[i].cpuset);
+            CPU_SET(pingpong_cpu, &thread_infos[i].cpuset);
+            pthread_attr_setaffinity_np(&thread_infos[i].attr, sizeof(cpu_set_t), &thread_infos[i].cpuset);
+        }
+        ring_threads = nr;
+        atomic_store(&stop, false);
+        atomic_store(&handoff_ns, 0); // thread 0's first wakeup is thread creation, not a switch
+        atomic_store(&thread_infos[0].go, 1);
+
+        end = now_ns() + duration * 1000000000L;
+
+        printf("Running %s futex pingpong with %ld threads on cpu %ld for %ld seconds:\n", smokewagon ? "smokewagon" : "inactive", nr, pingpong_cpu, duration);
+
+        for (long i=0; i<nr; i++) {
+            int ret = pthread_create(&thread_infos[i].thread, &thread_infos[i].attr, pingpong, &thread_infos[i]);
+            if (ret) {
+                // the token would stop at the missing thread, and everyone else would wait forever
+                printf("ERROR: return code for thread %ld from pthread_create() is %d, the ring can't run without it\n", i, ret);
+                return EXIT_FAILURE;
+            }
+        }
+        for (long i=0; i<nr; i++) {
+            pthread_join(thread_infos[i].thread, NULL);
+        }
+
+        unsigned long total_ns = 0;
+        switch_ns[t][1] = ULONG_MAX;
+        for (long i=0; i<nr; i++) {
+            switches[t] += thread_infos[i].counter;
+            total_ns += thread_infos[i].total_ns;
+            errors[t][0] += thread_infos[i].errors;
+            if (thread_infos[i].min_ns < switch_ns[t][1]) switch_ns[t][1] = thread_infos[i].min_ns;
+            if (thread_infos[i].max_ns > switch_ns[t][2]) switch_ns[t][2] = thread_infos[i].max_ns;
+            printf("tid %ld switched in %lu times\n", i, thread_infos[i].counter);
+            munmap(thread_infos[i].my_page, PAGE_SIZE);
+        }
+        switch_ns[t][0] = switches[t] ? total_ns / switches[t] : 0;
+        printf("%ld threads performed %lu switches, avg %lu ns, min %lu ns, max %lu ns, %lu integrity errors.\n\n",
+            nr, switches[t], switch_ns[t][0], switch_ns[t][1], switch_ns[t][2], errors[t][0]);
+        if (errors[t][0]) failed = true;
+    }
+
+    for (long t=0; run_migrate && t<threads; t++) {
+        long nr = t+1;
+
+        for (long i=0; i<nr; i++) {
+            reset_info(&thread_infos[i]);
+
+            CPU_ZERO(&thread_infos[i].cpuset);
+            CPU_SET(i % nr_cpus, &thread_infos[i].cpuset);
+            pthread_attr_setaffinity_np(&thread_infos[i].attr, sizeof(cpu_set_t), &thread_infos[i].cpuset);
+        }
+
+        end = now_ns() + duration * 1000000000L;
+
+        printf("Running %s map-write-unmap-migrate loop with %ld threads for %ld seconds:\n", smokewagon ? "smokewagon" : "inactive", nr, duration);
+
+        for (long i=0; i<nr; i++) {
+            int ret = pthread_create(&thread_infos[i].thread, &thread_infos[i].attr, migrate, &thread_infos[i]);
+            thread_infos[i].created = ret == 0;
+            if (ret) {
+                printf("ERROR: return code for thread %ld from pthread_create() is %d\n", i, ret);
+                thread_infos[i].errors++;
+            }
+        }
+        for (long i=0; i<nr; i++) {
+            if (thread_infos[i].created) pthread_join(thread_infos[i].thread, NULL);
+        }
+
+        unsigned long total_ns = 0;
+        migration_ns[t][1] = ULONG_MAX;
+        for (long i=0; i<nr; i++) {
+            loops[t] += thread_infos[i].counter;
+            migrations[t] += thread_infos[i].migrations;
+            total_ns += thread_infos[i].total_ns;
+            errors[t][1] += thread_infos[i].errors;
+            if (thread_infos[i].min_ns < migration_ns[t][1]) migration_ns[t][1] = thread_infos[i].min_ns;
+            if (thread_infos[i].max_ns > migration_ns[t][2]) migration_ns[t][2] = thread_infos[i].max_ns;
+            printf("tid %ld performed %lu loops and %lu migrations\n", i, thread_infos[i].counter, thread_infos[i].migrations);
+        }
+        if (migrations[t] == 0) migration_ns[t][1] = 0;
+        migration_ns[t][0] = migrations[t] ? total_ns / migrations[t] : 0;
+        printf("%ld threads performed %lu loops and %lu migrations, avg %lu ns, min %lu ns, max %lu ns, %lu errors.\n\n",
+            nr, loops[t], migrations[t], migration_ns[t][0], migration_ns[t][1], migration_ns[t][2], errors[t][1]);
+        if (errors[t][1]) failed = true;
+    }
+
+    printf("microbenchmarking complete\n");
+
+    munmap(big_mmap_ptr, ONE_GB_SIZE*(threads+1));
+    for (long i=0; i<threads; i++) {
+        pthread_attr_destroy(&thread_infos[i].attr);
+    }
+
+    // output statistics, one file per workload
+    for (int w=0; w<2; w++) {
+        if ((w == 0 && !run_pingpong) || (w == 1 && !run_migrate)) continue;
+
+        char filename[PATH_MAX];
+        snprintf(filename, sizeof(filename), "result-microbenchmark-migration-%s-%s-%s.csv",
+            w == 0 ? "pingpong" : "migrate", smokewagon ? "smokewagon" : "inactive", u.release);
+
+        printf("opening %s\n", filename);
+        FILE *fptr = fopen(filename, "w");
+        if(fptr == NULL) {
+            perror("file opening error!");
+            return EXIT_FAILURE;
+        }
+
+        if (w == 0) {
+            fprintf(fptr, "threads,switches,avg_switch_ns,min_switch_ns,max_switch_ns,errors\n");
+            for (long t=1; t<threads; t++) {
+                fprintf(fptr, "%ld, %lu, %lu, %lu, %lu, %lu\n", t+1, switches[t], switch_ns[t][0], switch_ns[t][1], switch_ns[t][2], errors[t][0]);
+            }
+        } else {
+            fprintf(fptr, "threads,loops,migrations,avg_migration_ns,min_migration_ns,max_migration_ns,errors\n");
+            for (long t=0; t<threads; t++) {
+                fprintf(fptr, "%ld, %lu, %lu, %lu, %lu, %lu, %lu\n", t+1, loops[t], migrations[t], migration_ns[t][0], migration_ns[t][1], migration_ns[t][2], errors[t][1]);
+            }
+        }
+        fclose(fptr);
+        printf("totals written to %s\n", filename);
+    }
+
+    free(switches);
+    free(switch_ns);
+    free(loops);
+    free(migrations);
+    free(migration_ns);
+    free(errors);
+    free(thread_infos);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,363 @@
+/* microbenchmark-mremap.c - each thread grows and shrinks (or moves) its own buffer with mremap
+ *
+ * grow:  mremap(MREMAP_MAYMOVE) the buffer to twice its size, touch the new half, and shrink it back.
+ *        the kernel moves the buffer when it can't grow in place, which is glibc realloc's path.
+ * move:  (-x) mremap(MREMAP_MAYMOVE|MREMAP_FIXED) the whole buffer back and forth between two slots,
+ *        so every call moves every page table entry and has to flush the old range. the slot it left
+ *        is mapped PROT_NONE again straight away, so nothing else can land there before the move back.
+ * buffer sizes are swept by factors of 4 from -z to -Z KiB (64 KiB to 256 MiB by default), and the
+ * largest buffers for every thread, doubled in grow mode, have to fit in free memory. every page
+ * of the buffer carries a stamp, which is spot-checked each loop and fully checked after each run.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>     // for ULONG_MAX, PATH_MAX
+#include <pthread.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>     // getopt guide: https://azrael.digipen.edu/~mmead/www/mg/getopt/index.html
+#include <ctype.h>      // for isdigit()
+#include <sched.h>
+#include <sys/utsname.h> // for uname syscall
+
+#define PAGE_SIZE   4096
+#define MAP_PRIVATE_TLB 0x200000
+
+struct __attribute__ ((aligned (64))) per_thread_info {
+    int tid;
+    pthread_t thread;
+    pthread_attr_t attr;
+    cpu_set_t cpuset;
+    unsigned long counter;          // mremap calls
+    unsigned long moves;            // calls that returned a different address
+    unsigned long errors;
+    unsigned long total_ns;
+    unsigned long max_ns;
+    unsigned long* buffer;
+    unsigned long* slots[2];        // move mode: where the buffer bounces between
+};
+
+long threads = 4;
+long duration = 5;
+long min_kib = 64;
+long max_kib = 256 * 1024;
+long nr_cpus;
+long end;
+size_t size;                        // current buffer size in bytes
+
+int mmap_flags = MAP_PRIVATE|MAP_ANONYMOUS;
+bool smokewagon = false;
+bool move = false;
+
+static long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+// every page starts with its owner and page number, so a page that ended up somewhere else is obvious
+static unsigned long stamp(int tid, size_t page) {
+    return ((unsigned long) tid << 40) | page;
+}
+
+static bool check_page(struct per_thread_info* my_info, unsigned long* buf, size_t page) {
+    if (buf[page * (PAGE_SIZE/sizeof(unsigned long))] != stamp(my_info->tid, page)) {
+        printf("uhoh, tid: %d page %zu reads %lx instead of %lx\n", my_info->tid, page,
+            buf[page * (PAGE_SIZE/sizeof(unsigned long))], stamp(my_info->tid, page));
+        my_info->errors++;
+        return false;
+    }
+    return true;
+}
+
+static void* timed_mremap(struct per_thread_info* my_info, void* old, size_t old_size, size_t new_size, int flags, void* new_address) {
+    long before = now_ns();
+    void* ptr = mremap(old, old_size, new_size, flags, new_address);
+    unsigned long ns = now_ns() - before;
+
+    my_info->total_ns += ns;
+    if (ns > my_info->max_ns) my_info->max_ns = ns;
+    my_info->counter++;
+    if (ptr != MAP_FAILED && ptr != old) my_info->moves++;
+    return ptr;
+}
+
+void* test_smokewagon(void* info_ptr) {
+    struct per_thread_info* my_info = info_ptr;
+    int tid = my_info->tid;
+    size_t pages = size / PAGE_SIZE;
+    unsigned long* buf = my_info->buffer;
+    int slot = 0;
+
+    do {
+        if (move) {
+            slot = !slot;
+            buf = timed_mremap(my_info, buf, size, size, MREMAP_MAYMOVE|MREMAP_FIXED, my_info->slots[slot]);
+            if (buf == MAP_FAILED) {
+                printf("mremap() move for tid: %d failed: %s\n", tid, strerror(errno));
+                my_info->errors++;
+                return info_ptr;
+            }
+            // mremap unmapped the slot we left, keep it reserved for the move back
+            if (mmap(my_info->slots[!slot], size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED, -1, 0) == MAP_FAILED) {
+                printf("re-reserving the old slot for tid: %d failed: %s\n", tid, strerror(errno));
+                my_info->errors++;
+                my_info->buffer = buf;
+                return info_ptr;
+            }
+        } else {
+            buf = timed_mremap(my_info, buf, size, 2*size, MREMAP_MAYMOVE, NULL);
+            if (buf == MAP_FAILED) {
+                printf("mremap() grow for tid: %d failed: %s\n", tid, strerror(errno));
+                my_info->errors++;
+                return info_ptr;
+            }
+            my_info->buffer = buf;
+
+            // fault in every new page so the shrink has the whole new half to zap
+            for (size_t p = pages; p < 2*pages; p++) {
+                buf[p * (PAGE_SIZE/sizeof(unsigned long))] = stamp(tid, p);
+            }
+
+            buf = timed_mremap(my_info, buf, 2*size, size, 0, NULL);
+            if (buf == MAP_FAILED) {
+                printf("mremap() shrink for tid: %d failed: %s\n", tid, strerror(errno));
+                my_info->errors++;
+                return info_ptr;
+            }
+        }
+        my_info->buffer = buf;
+
+        // the first and last pages must have come along
+        check_page(my_info, buf, 0);
+        check_page(my_info, buf, pages - 1);
+    } while (end > now_ns());
+
+    return info_ptr;
+}
+
+int main(int argc, char *argv[]) {
+    bool failed = false;
+
+    // check opts
+    int opt;
+    while ((opt = getopt(argc, argv, "sxt:d:z:Z:")) != -1) {
+        switch(opt) {
+            case 't':
+            case 'd':
+            case 'z':
+            case 'Z':
+                for (char *p = optarg; *p; p++) {
+                    if (!isdigit(*p)) {
+                        printf("Error: -%c requires a positive integer\n", opt);
+                        return EXIT_FAILURE;
+                    }
+                }
+                if (opt == 't') {
+                    int opt_threads = atoi(optarg);
+                    if (opt_threads > 0) {
+                        threads = opt_threads;
+                    } else {
+                        printf("Error: -t is %d, but should be at least 1, defaulting to 4\n", opt_threads);
+                    }
+                } else if (opt == 'd') {
+                    duration = atoi(optarg);
+                } else if (opt == 'z') {
+                    min_kib = atol(optarg);
+                } else {
+                    max_kib = atol(optarg);
+                }
+                break;
+            case 's':
+                smokewagon = true;
+                break;
+            case 'x':
+                move = true;
+                break;
+        }
+    }
+    if (min_kib < PAGE_SIZE/1024 || min_kib % (PAGE_SIZE/1024) || min_kib > max_kib) {
+        printf("buffer sizes (-z %ld, -Z %ld) must be whole pages and -z can't be larger than -Z\n", min_kib, max_kib);
+        return EXIT_FAILURE;
+    }
+
+    nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // every thread's buffer is fully populated, and grows to twice that
+    long free_kib = sysconf(_SC_AVPHYS_PAGES) * (PAGE_SIZE/1024);
+    long largest_kib = min_kib;
+    while (largest_kib * 4 <= max_kib) {
+        largest_kib *= 4;
+    }
+    if (threads * largest_kib * (move ? 1 : 2) > free_kib) {
+        printf("%ld threads with %ld KiB buffers need %ld KiB, but only %ld KiB are free, lower -Z or -t\n",
+            threads, largest_kib, threads * largest_kib * (move ? 1 : 2), free_kib);
+        return EXIT_FAILURE;
+    }
+
+    int sizes = 0;
+    for (long kib = min_kib; kib <= max_kib; kib *= 4) {
+        sizes++;
+    }
+
+    struct per_thread_info* thread_infos = aligned_alloc(64, threads * sizeof(struct per_thread_info));
+    unsigned long (*calls)[3] = calloc(threads * sizes, sizeof(*calls));   // calls, moves, errors
+    unsigned long (*call_ns)[2] = calloc(threads * sizes, sizeof(*call_ns)); // avg, max
+    if (!thread_infos || !calls || !call_ns) {
+        perror("thread state allocation failed");
+        return EXIT_FAILURE;
+    }
+    memset(thread_infos, 0, threads * sizeof(struct per_thread_info));
+
+    printf("mremap() microbenchmark, testing from 1 to %ld threads and %ld KiB to %ld KiB buffers for %ld seconds each\n\n", threads, min_kib, max_kib, duration);
+    printf("mode: %s\n", move ? "move (MREMAP_FIXED)" : "grow/shrink (MREMAP_MAYMOVE)");
+
+    if (smokewagon) {
+        mmap_flags |= MAP_PRIVATE_TLB;
+        printf("smokewagon:  ON\n\n");
+    } else {
+        printf("smokewagon: OFF\n\n");
+    }
+
+    // get and print uname
+    struct utsname u;
+    if (uname(&u) == -1) {
+        perror("uname\n");
+        return EXIT_FAILURE;
+    }
+    printf("running on: %s %s %s %s %s\n",
+        u.sysname,
+        u.nodename,
+        u.release,
+        u.version,
+        u.machine);
+
+    for (long i=0; i<threads; i++) {
+        thread_infos[i].tid = i;
+        CPU_ZERO(&thread_infos[i].cpuset);
+        CPU_SET(i % nr_cpus, &thread_infos[i].cpuset);
+        pthread_attr_init(&thread_infos[i].attr);
+        pthread_attr_setaffinity_np(&thread_infos[i].attr, sizeof(cpu_set_t), &thread_infos[i].cpuset);
+    }
+
+    printf("\nbegin benchmarking\n\n");
+
+    int s = 0;
+    for (long kib = min_kib; kib <= max_kib; kib *= 4, s++) {
+        size = kib * 1024;
+        size_t pages = size / PAGE_SIZE;
+
+        for (long t=0; t<threads; t++) {
+            long cell = s * threads + t;
+
+            // fresh, fully populated and stamped buffers for every run
+            for (long i=0; i<=t; i++) {
+                if (move) {
+                    // reserve both slots together, and the thread re-reserves whichever one it moves out of
+                    char* reservation = mmap(NULL, 2*size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+                    if (reservation == MAP_FAILED) {
+                        printf("slot reservation for tid: %ld failed: %s\n", i, strerror(errno));
+                        return -1;
+                    }
+                    thread_infos[i].slots[0] = (unsigned long*) reservation;
+                    thread_infos[i].slots[1] = (unsigned long*) (reservation + size);
+                    thread_infos[i].buffer = mmap(reservation, size, PROT_READ|PROT_WRITE, mmap_flags|MAP_FIXED, -1, 0);
+                } else {
+                    thread_infos[i].buffer = mmap(NULL, size, PROT_READ|PROT_WRITE, mmap_flags, -1, 0);
+                }
+                if (thread_infos[i].buffer == MAP_FAILED) {
+                    printf("buffer mmap() for tid: %ld failed: %s\n", i, strerror(errno));
+                    return -1;
+                }
+                for (size_t p=0; p<pages; p++) {
+                    thread_infos[i].buffer[p * (PAGE_SIZE/sizeof(unsigned long))] = stamp(i, p);
+                }
+                thread_infos[i].counter = 0;
+                thread_infos[i].moves = 0;
+                thread_infos[i].errors = 0;
+                thread_infos[i].total_ns = 0;
+                thread_infos[i].max_ns = 0;
+            }
+
+            end = now_ns() + duration * 1000000000L;
+
+            printf("Running %s %s loop on %ld KiB buffers with %ld threads for %ld seconds:\n", smokewagon ? "smokewagon" : "inactive", move ? "move" : "grow-shrink", kib, t+1, duration);
+
+            for (long i=0; i<=t; i++) {
+                int ret = pthread_create(&thread_infos[i].thread, &thread_infos[i].attr, test_smokewagon, &thread_infos[i]);
+                if (ret) printf("ERROR: return code for thread %ld from pthread_create() is %d\n", i, ret);
+            }
+            for (long i=0; i<=t; i++) {
+                pthread_join(thread_infos[i].thread, NULL);
+            }
+
+            unsigned long total_ns = 0;
+            for (long i=0; i<=t; i++) {
+                // every page must still be where it belongs
+                for (size_t p=0; p<pages; p++) {
+                    if (!check_page(&thread_infos[i], thread_infos[i].buffer, p)) break;
+                }
+                munmap(thread_infos[i].buffer, size);
+                if (move) {
+                    munmap(thread_infos[i].slots[0], 2*size);
+                }
+
+                calls[cell][0] += thread_infos[i].counter;
+                calls[cell][1] += thread_infos[i].moves;
+                calls[cell][2] += thread_infos[i].errors;
+                total_ns += thread_infos[i].total_ns;
+                if (thread_infos[i].max_ns > call_ns[cell][1]) call_ns[cell][1] = thread_infos[i].max_ns;
+                printf("tid %ld performed %lu mremaps, %lu moved\n", i, thread_infos[i].counter, thread_infos[i].moves);
+            }
+            call_ns[cell][0] = calls[cell][0] ? total_ns / calls[cell][0] : 0;
+            printf("%ld threads performed %lu mremaps (%lu moved) on %ld KiB buffers, avg %lu ns, max %lu ns, %lu errors.\n\n",
+                t+1, calls[cell][0], calls[cell][1], kib, call_ns[cell][0], call_ns[cell][1], calls[cell][2]);
+            if (calls[cell][2]) failed = true;
+        }
+    }
+
+    printf("microbenchmarking complete\n");
+
+    for (long i=0; i<threads; i++) {
+        pthread_attr_destroy(&thread_infos[i].attr);
+    }
+
+    // output statistics
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "result-microbenchmark-mremap-%s-%s-%s.csv",
+        move ? "move" : "growshrink", smokewagon ? "smokewagon" : "inactive", u.release);
+
+    printf("opening %s\n", filename);
+    FILE *fptr = fopen(filename, "w");
+    if(fptr == NULL) {
+        perror("file opening error!");
+        return EXIT_FAILURE;
+    }
+
+    // moved_gib_per_sec counts the bytes whose page table entries each call carried along
+    fprintf(fptr, "threads,size_kib,calls,moves,avg_call_ns,max_call_ns,moved_gib_per_sec,errors\n");
+    s = 0;
+    for (long kib = min_kib; kib <= max_kib; kib *= 4, s++) {
+        for (long t=0; t<threads; t++) {
+            long cell = s * threads + t;
+            double gib = (double) calls[cell][1] * kib / (1024 * 1024);
+            fprintf(fptr, "%ld, %ld, %lu, %lu, %lu, %lu, %.3f, %lu\n", t+1, kib, calls[cell][0], calls[cell][1],
+                call_ns[cell][0], call_ns[cell][1], gib / duration, calls[cell][2]);
+        }
+    }
+    fclose(fptr);
+    printf("totals written to %s\n", filename);
+
+    free(calls);
+    free(call_ns);
+    free(thread_infos);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
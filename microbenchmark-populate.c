@@ -0,0 +1,339 @@
+/* microbenchmark-populate.c - how fast 1..t threads can fault in -m MiB of anonymous memory, by strategy
+ *
+ * the -m MiB are split evenly between the threads (in whole 2 MiB pieces), and each strategy fills
+ * them its own way:
+ *   touch               write a byte of every page, with MADV_NOHUGEPAGE
+ *   touch-thp           the same with MADV_HUGEPAGE, so each first touch faults a 2 MiB page
+ *   map-populate        mmap(MAP_POPULATE), with no advice, since the mmap has faulted everything in
+ *                       before madvise could run. whether it gets huge pages is up to the sysfs THP
+ *                       setting alone, unlike every other strategy
+ *   populate-write      MADV_POPULATE_WRITE, with MADV_NOHUGEPAGE
+ *   populate-write-thp  MADV_POPULATE_WRITE, with MADV_HUGEPAGE
+ * by default every thread mmaps its own region, and the mmap is part of the time. with -x all the
+ * threads fill their own slice of one region mapped beforehand, so they share its vma; map-populate
+ * is then a single mmap of the whole region that the threads can't help with. -s maps everything
+ * MAP_PRIVATE_TLB. reports the wall time from start until the last thread is done, GiB/s, and how
+ * much actually ended up in huge pages (AnonHugePages), since THP also depends on the sysfs settings.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>     // for PATH_MAX
+#include <pthread.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>     // getopt guide: https://azrael.digipen.edu/~mmead/www/mg/getopt/index.html
+#include <ctype.h>      // for isdigit()
+#include <sched.h>
+#include <sys/utsname.h> // for uname syscall
+
+#define PAGE_SIZE   4096
+#define HUGE_SIZE   (2UL * 1024 * 1024)
+#define MAP_PRIVATE_TLB 0x200000
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+enum strategy {
+    TOUCH,
+    TOUCH_THP,
+    POPULATE_MAP,
+    POPULATE_WRITE,
+    POPULATE_WRITE_THP,
+    NR_STRATEGIES,
+};
+
+const char* strategy_names[NR_STRATEGIES] = { "touch", "touch-thp", "map-populate", "populate-write", "populate-write-thp" };
+
+struct __attribute__ ((aligned (64))) per_thread_info {
+    int tid;
+    pthread_t thread;
+    pthread_attr_t attr;
+    cpu_set_t cpuset;
+    char* region;                   // where its slice goes
+    unsigned long errors;
+    long done;                      // when it finished
+};
+
+long threads;
+long total_mib = 4096;
+size_t slice;                       // bytes per thread this run
+enum strategy strategy;
+long start;
+pthread_barrier_t barrier;
+
+int mmap_flags = MAP_PRIVATE|MAP_ANONYMOUS;
+bool smokewagon = false;
+bool shared = false;
+
+static long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static bool thp(enum strategy s) {
+    return s == TOUCH_THP || s == POPULATE_WRITE_THP;
+}
+
+static bool map_region(char* region, size_t size, int flags) {
+    char* ptr = mmap(region, size, PROT_READ|PROT_WRITE, mmap_flags|MAP_FIXED|flags, -1, 0);
+    if (ptr != region) {
+        printf("mmap() of %zu MiB failed: %s\n", size >> 20, ptr == MAP_FAILED ? strerror(errno) : "wrong address");
+        return false;
+    }
+    return true;
+}
+
+void* test_smokewagon(void* info_ptr) {
+    struct per_thread_info* my_info = info_ptr;
+    char* region = my_info->region;
+
+    pthread_barrier_wait(&barrier);
+
+    if (!shared) {
+        if (!map_region(region, slice, strategy == POPULATE_MAP ? MAP_POPULATE : 0)) {
+            my_info->errors++;
+            goto out;
+        }
+        if (strategy != POPULATE_MAP && madvise(region, slice, thp(strategy) ? MADV_HUGEPAGE : MADV_NOHUGEPAGE)) {
+            printf("madvise(%s) for tid: %d failed: %s\n", thp(strategy) ? "MADV_HUGEPAGE" : "MADV_NOHUGEPAGE", my_info->tid, strerror(errno));
+            my_info->errors++;
+        }
+    }
+
+    if (strategy == TOUCH || strategy == TOUCH_THP) {
+        for (size_t off = 0; off < slice; off += PAGE_SIZE) {
+            region[off] = 'y';
+        }
+    } else if (strategy == POPULATE_WRITE || strategy == POPULATE_WRITE_THP) {
+        if (madvise(region, slice, MADV_POPULATE_WRITE)) {
+            printf("madvise(MADV_POPULATE_WRITE) for tid: %d failed: %s\n", my_info->tid, strerror(errno));
+            my_info->errors++;
+        }
+    }
+
+out:
+    my_info->done = now_ns();
+    return info_ptr;
+}
+
+// how much of the process is in anonymous huge pages right now
+static long huge_mib(void) {
+    FILE* f = fopen("/proc/self/smaps_rollup", "r");
+    char line[256];
+    long kib = -1;
+    if (!f) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "AnonHugePages: %ld kB", &kib) == 1) break;
+    }
+    fclose(f);
+    return kib < 0 ? -1 : kib / 1024;
+}
+
+int main(int argc, char *argv[]) {
+    bool failed = false;
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = nr_cpus;
+
+    // check opts
+    int opt;
+    while ((opt = getopt(argc, argv, "sxt:m:")) != -1) {
+        switch(opt) {
+            case 't':
+            case 'm':
+                for (char *p = optarg; *p; p++) {
+                    if (!isdigit(*p)) {
+                        printf("Error: -%c requires a positive integer\n", opt);
+                        return EXIT_FAILURE;
+                    }
+                }
+                if (opt == 't') {
+                    int opt_threads = atoi(optarg);
+                    if (opt_threads > 0) {
+                        threads = opt_threads;
+                    } else {
+                        printf("Error: -t is %d, but should be at least 1, defaulting to %ld\n", opt_threads, nr_cpus);
+                    }
+                } else {
+                    total_mib = atol(optarg);
+                }
+                break;
+            case 's':
+                smokewagon = true;
+                break;
+            case 'x':
+                shared = true;
+                break;
+        }
+    }
+    if (total_mib * 1024 * 1024 < (long) (threads * HUGE_SIZE)) {
+        printf("-m %ld MiB isn't enough for 2 MiB per thread with %ld threads\n", total_mib, threads);
+        return EXIT_FAILURE;
+    }
+
+    struct per_thread_info* thread_infos = aligned_alloc(64, threads * sizeof(struct per_thread_info));
+    long (*wall_ns)[NR_STRATEGIES] = calloc(threads, sizeof(*wall_ns));
+    long (*huge)[NR_STRATEGIES] = calloc(threads, sizeof(*huge));
+    unsigned long (*errors)[NR_STRATEGIES] = calloc(threads, sizeof(*errors));
+    size_t* slices = calloc(threads, sizeof(size_t));
+    if (!thread_infos || !wall_ns || !huge || !errors || !slices) {
+        perror("thread state allocation failed");
+        return EXIT_FAILURE;
+    }
+    memset(thread_infos, 0, threads * sizeof(struct per_thread_info));
+
+    printf("populate microbenchmark, filling %ld MiB with 1 to %ld threads, %s\n\n", total_mib, threads,
+        shared ? "slices of one shared region (-x)" : "a region per thread");
+
+    if (smokewagon) {
+        mmap_flags |= MAP_PRIVATE_TLB;
+        printf("smokewagon:  ON\n\n");
+    } else {
+        printf("smokewagon: OFF\n\n");
+    }
+
+    // get and print uname
+    struct utsname u;
+    if (uname(&u) == -1) {
+        perror("uname\n");
+        return EXIT_FAILURE;
+    }
+    printf("running on: %s %s %s %s %s\n",
+        u.sysname,
+        u.nodename,
+        u.release,
+        u.version,
+        u.machine);
+
+    // the THP strategies only get huge pages if these allow it
+    char thp_line[128];
+    const char* thp_files[] = { "/sys/kernel/mm/transparent_hugepage/enabled", "/sys/kernel/mm/transparent_hugepage/defrag" };
+    for (int i = 0; i < 2; i++) {
+        FILE* f = fopen(thp_files[i], "r");
+        if (f && fgets(thp_line, sizeof(thp_line), f)) {
+            printf("%s: %s", thp_files[i], thp_line);
+        }
+        if (f) fclose(f);
+    }
+
+    for (long i=0; i<threads; i++) {
+        thread_infos[i].tid = i;
+        CPU_ZERO(&thread_infos[i].cpuset);
+        CPU_SET(i % nr_cpus, &thread_infos[i].cpuset);
+        pthread_attr_init(&thread_infos[i].attr);
+        pthread_attr_setaffinity_np(&thread_infos[i].attr, sizeof(cpu_set_t), &thread_infos[i].cpuset);
+    }
+
+    printf("\nbegin benchmarking\n\n");
+
+    for (strategy = 0; strategy < NR_STRATEGIES; strategy++) {
+        for (long t=0; t<threads; t++) {
+            slice = (total_mib * 1024 * 1024 / (t+1)) & ~(HUGE_SIZE - 1);
+            slices[t] = slice;
+            size_t size = slice * (t+1);
+
+            // reserve 2 MiB aligned room for every slice, back to back with -x and with a 2 MiB gap
+            // between them otherwise, so per-thread regions never merge into one vma
+            size_t stride = shared ? slice : slice + HUGE_SIZE;
+            size_t span = stride * (t+1) + HUGE_SIZE;
+            char* reservation = mmap(NULL, span, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+            if (reservation == MAP_FAILED) {
+                printf("reserving %zu MiB failed: %s\n", span >> 20, strerror(errno));
+                return EXIT_FAILURE;
+            }
+            char* base = (char*) (((unsigned long) reservation + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1));
+            for (long i=0; i<=t; i++) {
+                thread_infos[i].region = base + i * stride;
+                thread_infos[i].errors = 0;
+            }
+
+            pthread_barrier_init(&barrier, NULL, t+2);
+            for (long i=0; i<=t; i++) {
+                int ret = pthread_create(&thread_infos[i].thread, &thread_infos[i].attr, test_smokewagon, &thread_infos[i]);
+                if (ret) {
+                    // the barrier counts on every thread, so there's no running without it
+                    printf("ERROR: return code for thread %ld from pthread_create() is %d\n", i, ret);
+                    return EXIT_FAILURE;
+                }
+            }
+
+            printf("Running %s %s with %ld threads, %zu MiB each:\n", smokewagon ? "smokewagon" : "inactive", strategy_names[strategy], t+1, slice >> 20);
+
+            unsigned long run_errors = 0;
+            if (shared && strategy != POPULATE_MAP) {
+                // the shared region is mapped and advised up front, only filling it is timed
+                if (!map_region(base, size, 0)) {
+                    run_errors++;
+                } else if (madvise(base, size, thp(strategy) ? MADV_HUGEPAGE : MADV_NOHUGEPAGE)) {
+                    printf("madvise() of the shared region failed: %s\n", strerror(errno));
+                    run_errors++;
+                }
+            }
+            start = now_ns();
+            if (shared && strategy == POPULATE_MAP) {
+                // one call for the whole region, the threads have nothing left to do
+                if (!map_region(base, size, MAP_POPULATE)) run_errors++;
+            }
+            pthread_barrier_wait(&barrier);
+            long last = start;
+            for (long i=0; i<=t; i++) {
+                pthread_join(thread_infos[i].thread, NULL);
+                if (thread_infos[i].done > last) last = thread_infos[i].done;
+                run_errors += thread_infos[i].errors;
+            }
+            pthread_barrier_destroy(&barrier);
+
+            wall_ns[t][strategy] = last - start;
+            huge[t][strategy] = huge_mib();
+            errors[t][strategy] = run_errors;
+            munmap(reservation, span);
+
+            double gib = (double) size / (1024 * 1024 * 1024);
+            printf("%ld threads populated %.2f GiB in %.3f ms, %.2f GiB/s, %ld MiB in huge pages, %lu errors.\n\n",
+                t+1, gib, wall_ns[t][strategy] / 1e6, gib / (wall_ns[t][strategy] / 1e9), huge[t][strategy], run_errors);
+            if (run_errors) failed = true;
+        }
+    }
+
+    printf("microbenchmarking complete\n");
+
+    for (long i=0; i<threads; i++) {
+        pthread_attr_destroy(&thread_infos[i].attr);
+    }
+
+    // output statistics
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "result-microbenchmark-populate-%s-%s-%s.csv",
+        shared ? "shared" : "perthread", smokewagon ? "smokewagon" : "inactive", u.release);
+
+    printf("opening %s\n", filename);
+    FILE *fptr = fopen(filename, "w");
+    if(fptr == NULL) {
+        perror("file opening error!");
+        return EXIT_FAILURE;
+    }
+
+    fprintf(fptr, "strategy,threads,mib,wall_ns,gib_per_sec,huge_mib,errors\n");
+    for (int s = 0; s < NR_STRATEGIES; s++) {
+        for (long t=0; t<threads; t++) {
+            double gib = (double) slices[t] * (t+1) / (1024 * 1024 * 1024);
+            fprintf(fptr, "%s, %ld, %zu, %ld, %.3f, %ld, %lu\n", strategy_names[s], t+1, slices[t] * (t+1) >> 20,
+                wall_ns[t][s], gib / (wall_ns[t][s] / 1e9), huge[t][s], errors[t][s]);
+        }
+    }
+    fclose(fptr);
+    printf("totals written to %s\n", filename);
+
+    free(wall_ns);
+    free(huge);
+    free(errors);
+    free(slices);
+    free(thread_infos);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
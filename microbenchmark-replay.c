@@ -0,0 +1,457 @@
+/* microbenchmark-replay.c - replays a recorded application's mmap/munmap/mprotect/madvise/mremap calls
+ *
+ * the trace comes from vmtrace.py, which turns strace output into per-thread calls at offsets into
+ * one arena. the arena is found by reserving it and unmapping it again, then every thread of the
+ * trace gets a replay thread, pinned round robin, that issues its calls at arena + offset. mmaps
+ * that weren't MAP_FIXED in the app use MAP_FIXED_NOREPLACE, so a replay that drifts from the
+ * original shows up as errors instead of mapping over something. nothing else may map memory while
+ * the replay runs, or the kernel could put it in the arena, so nothing prints until the end.
+ *
+ * as fast as possible by default, so each thread keeps its own order but threads race each other;
+ * -f replays time faithfully, each call waiting until its recorded time since the start.
+ * -s adds MAP_PRIVATE_TLB to every mmap. the trace doesn't say what the app touched, so up to -p
+ * pages (16 by default) of every range made writable get written, untimed, so munmap, mprotect and
+ * madvise have page table entries to zap and TLB entries to flush.
+ *
+ * reports the total replay time and per-call-type latency (mean, p50, p99, max).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>     // for PATH_MAX
+#include <pthread.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>     // getopt guide: https://azrael.digipen.edu/~mmead/www/mg/getopt/index.html
+#include <ctype.h>      // for isdigit()
+#include <libgen.h>     // for basename()
+#include <sched.h>
+#include <sys/utsname.h> // for uname syscall
+
+#define PAGE_SIZE   4096
+#define MAP_PRIVATE_TLB 0x200000
+#define ARENA_ALIGN (1UL << 30)     // vmtrace.py lays clusters out 1 GB aligned
+
+enum call_type {
+    MMAP,
+    MUNMAP,
+    MPROTECT,
+    MADVISE,
+    MREMAP,
+    NR_CALL_TYPES,
+};
+
+const char* call_names[NR_CALL_TYPES] = { "mmap", "munmap", "mprotect", "madvise", "mremap" };
+
+struct call {
+    long t_us;                      // since the first call of the trace
+    enum call_type type;
+    int arg;                        // prot for mmap and mprotect, advice for madvise, flags for mremap
+    int flags;                      // mmap flags
+    unsigned long offset;
+    unsigned long len;
+    unsigned long new_len;          // mremap
+    unsigned long new_offset;       // mremap, where it ended up
+};
+
+struct __attribute__ ((aligned (64))) per_thread_info {
+    int tid;
+    pthread_t thread;
+    pthread_attr_t attr;
+    cpu_set_t cpuset;
+    struct call* calls;
+    long nr_calls;
+    long max_calls;
+    long* call_ns;                  // latency of every call, filled in by the replay
+    unsigned long errors;
+    long max_lag_ns;                // -f: how late the latest call started
+    long done_ns;                   // when the thread finished, since the start
+};
+
+long threads;
+long touch_pages = 16;
+char* arena;
+size_t arena_size;
+long start;
+pthread_barrier_t barrier;
+
+bool smokewagon = false;
+bool faithful = false;
+
+static long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static void sleep_until(long ns) {
+    struct timespec until = { .tv_sec = ns / 1000000000L, .tv_nsec = ns % 1000000000L };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+}
+
+// write the first few pages of a range that just became writable, the way the app would have
+static void touch(char* addr, unsigned long len, int prot) {
+    if (!(prot & PROT_WRITE)) return;
+    for (unsigned long i = 0; i < len / PAGE_SIZE && i < (unsigned long) touch_pages; i++) {
+        addr[i * PAGE_SIZE] = 'y';
+    }
+}
+
+// issue one call, returning its latency, or -1 if it failed or didn't land where it did in the app
+static long replay(struct call* c) {
+    char* addr = arena + c->offset;
+    long before, ns;
+    bool ok;
+
+    switch (c->type) {
+    case MMAP: {
+        int flags = (c->flags & ~MAP_FIXED_NOREPLACE) | (smokewagon ? MAP_PRIVATE_TLB : 0);
+        if (!(flags & MAP_FIXED)) flags |= MAP_FIXED_NOREPLACE;
+        before = now_ns();
+        ok = mmap(addr, c->len, c->arg, flags, -1, 0) == addr;
+        ns = now_ns() - before;
+        if (ok) touch(addr, c->len, c->arg);
+        break;
+    }
+    case MUNMAP:
+        before = now_ns();
+        ok = !munmap(addr, c->len);
+        ns = now_ns() - before;
+        break;
+    case MPROTECT:
+        before = now_ns();
+        ok = !mprotect(addr, c->len, c->arg);
+        ns = now_ns() - before;
+        if (ok) touch(addr, c->len, c->arg);
+        break;
+    case MADVISE:
+        before = now_ns();
+        ok = !madvise(addr, c->len, c->arg);
+        ns = now_ns() - before;
+        break;
+    case MREMAP: {
+        // the app's mremap either stayed put or moved, so make ours do the same thing
+        char* target = arena + c->new_offset;
+        if (target == addr) {
+            before = now_ns();
+            ok = mremap(addr, c->len, c->new_len, 0) == addr;
+        } else {
+            before = now_ns();
+            ok = mremap(addr, c->len, c->new_len, MREMAP_MAYMOVE|MREMAP_FIXED|(c->arg & MREMAP_DONTUNMAP), target) == target;
+        }
+        ns = now_ns() - before;
+        if (ok && c->new_len > c->len && target == addr) touch(addr + c->len, c->new_len - c->len, PROT_WRITE);
+        break;
+    }
+    default:
+        return -1;
+    }
+    return ok ? ns : -1;
+}
+
+void* test_smokewagon(void* info_ptr) {
+    struct per_thread_info* my_info = info_ptr;
+
+    pthread_barrier_wait(&barrier);
+    sleep_until(start);
+    for (long i = 0; i < my_info->nr_calls; i++) {
+        struct call* c = &my_info->calls[i];
+        if (faithful) {
+            long due = start + c->t_us * 1000;
+            long lag = now_ns() - due;
+            if (lag < 0) {
+                sleep_until(due);
+            } else if (lag > my_info->max_lag_ns) {
+                my_info->max_lag_ns = lag;
+            }
+        }
+        my_info->call_ns[i] = replay(c);
+        if (my_info->call_ns[i] < 0) my_info->errors++;
+    }
+    my_info->done_ns = now_ns() - start;
+
+    return info_ptr;
+}
+
+static int compare_long(const void* a, const void* b) {
+    long x = *(const long*) a, y = *(const long*) b;
+    return (x > y) - (x < y);
+}
+
+// vmtrace.py's output: a header, then "<thread> <t_us> <call> <offset> <len> <args...>" per line
+static int load_trace(const char* path, struct per_thread_info** infos) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        printf("can't open trace %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char line[256];
+    long nr_calls;
+    if (!fgets(line, sizeof(line), f) || sscanf(line, "# vmtrace 1 %zu %ld %ld", &arena_size, &threads, &nr_calls) != 3 || threads < 1) {
+        printf("%s doesn't start with a vmtrace.py header\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    *infos = aligned_alloc(64, threads * sizeof(struct per_thread_info));
+    if (!*infos) {
+        perror("thread state allocation failed");
+        fclose(f);
+        return -1;
+    }
+    memset(*infos, 0, threads * sizeof(struct per_thread_info));
+
+    long lineno = 1;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        int tid, used;
+        char name[16];
+        struct call c = { 0 };
+        if (sscanf(line, "%d %ld %15s %lu %lu%n", &tid, &c.t_us, name, &c.offset, &c.len, &used) != 5 || tid < 0 || tid >= threads) {
+            printf("uhoh, can't parse line %ld of %s: %s", lineno, path, line);
+            fclose(f);
+            return -1;
+        }
+        c.type = NR_CALL_TYPES;
+        for (int t = 0; t < NR_CALL_TYPES; t++) {
+            if (!strcmp(name, call_names[t])) c.type = t;
+        }
+
+        char* rest = line + used;
+        int args;
+        switch (c.type) {
+        case MMAP:     args = sscanf(rest, "%d %d", &c.arg, &c.flags) == 2; break;
+        case MUNMAP:   args = 1; break;
+        case MPROTECT:
+        case MADVISE:  args = sscanf(rest, "%d", &c.arg) == 1; break;
+        case MREMAP:   args = sscanf(rest, "%lu %d %lu", &c.new_len, &c.arg, &c.new_offset) == 3; break;
+        default:       args = 0; break;
+        }
+        if (!args || c.offset + c.len > arena_size || c.new_offset + c.new_len > arena_size) {
+            printf("uhoh, line %ld of %s isn't a call we can replay: %s", lineno, path, line);
+            fclose(f);
+            return -1;
+        }
+
+        struct per_thread_info* info = &(*infos)[tid];
+        if (info->nr_calls == info->max_calls) {
+            info->max_calls = info->max_calls ? 2 * info->max_calls : 1024;
+            info->calls = realloc(info->calls, info->max_calls * sizeof(struct call));
+            if (!info->calls) {
+                perror("trace allocation failed");
+                fclose(f);
+                return -1;
+            }
+        }
+        info->calls[info->nr_calls++] = c;
+    }
+    fclose(f);
+
+    long loaded = 0;
+    for (long i = 0; i < threads; i++) {
+        loaded += (*infos)[i].nr_calls;
+    }
+    if (loaded != nr_calls) {
+        printf("uhoh, %s says %ld calls but has %ld, truncated?\n", path, nr_calls, loaded);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    // check opts
+    int opt;
+    while ((opt = getopt(argc, argv, "sfp:")) != -1) {
+        switch(opt) {
+            case 'p':
+                for (char *p = optarg; *p; p++) {
+                    if (!isdigit(*p)) {
+                        printf("Error: -%c requires a positive integer\n", opt);
+                        return EXIT_FAILURE;
+                    }
+                }
+                touch_pages = atol(optarg);
+                break;
+            case 's':
+                smokewagon = true;
+                break;
+            case 'f':
+                faithful = true;
+                break;
+        }
+    }
+    if (optind != argc - 1) {
+        printf("usage: %s [-s] [-f] [-p touch_pages] trace.vmtrace\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char* trace = argv[optind];
+
+    struct per_thread_info* thread_infos;
+    if (load_trace(trace, &thread_infos)) {
+        return EXIT_FAILURE;
+    }
+
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long nr_calls = 0;
+    for (long i=0; i<threads; i++) {
+        nr_calls += thread_infos[i].nr_calls;
+    }
+
+    printf("mm syscall replay of %s: %ld calls from %ld threads in a %zu MiB arena\n\n", trace, nr_calls, threads, arena_size >> 20);
+    printf("mode: %s\n", faithful ? "time faithful" : "as fast as possible");
+    printf("smokewagon: %s\n\n", smokewagon ? " ON" : "OFF");
+
+    // get and print uname
+    struct utsname u;
+    if (uname(&u) == -1) {
+        perror("uname\n");
+        return EXIT_FAILURE;
+    }
+    printf("running on: %s %s %s %s %s\n",
+        u.sysname,
+        u.nodename,
+        u.release,
+        u.version,
+        u.machine);
+
+    // find room for the arena, and give it back once the threads (and their stacks) exist, so the
+    // replay maps into empty space like the app did
+    char* reservation = mmap(NULL, arena_size + ARENA_ALIGN, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (reservation == MAP_FAILED) {
+        printf("arena reservation of %zu MiB failed: %s\n", arena_size >> 20, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    arena = (char*) (((unsigned long) reservation + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1));
+
+    for (long i=0; i<threads; i++) {
+        thread_infos[i].tid = i;
+        thread_infos[i].call_ns = calloc(thread_infos[i].nr_calls + 1, sizeof(long));
+        if (!thread_infos[i].call_ns) {
+            perror("latency array allocation failed");
+            return EXIT_FAILURE;
+        }
+        CPU_ZERO(&thread_infos[i].cpuset);
+        CPU_SET(i % nr_cpus, &thread_infos[i].cpuset);
+        pthread_attr_init(&thread_infos[i].attr);
+        pthread_attr_setaffinity_np(&thread_infos[i].attr, sizeof(cpu_set_t), &thread_infos[i].cpuset);
+    }
+
+    printf("\nbegin replay\n\n");
+    fflush(stdout);
+
+    // every thread waits for the same start, so thread creation isn't part of the replay
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+    for (long i=0; i<threads; i++) {
+        int ret = pthread_create(&thread_infos[i].thread, &thread_infos[i].attr, test_smokewagon, &thread_infos[i]);
+        if (ret) {
+            printf("ERROR: return code for thread %ld from pthread_create() is %d\n", i, ret);
+            return EXIT_FAILURE;
+        }
+    }
+    munmap(reservation, arena_size + ARENA_ALIGN);
+    start = now_ns() + 1000000L;
+    pthread_barrier_wait(&barrier);
+    for (long i=0; i<threads; i++) {
+        pthread_join(thread_infos[i].thread, NULL);
+    }
+    munmap(arena, arena_size);
+    pthread_barrier_destroy(&barrier);
+
+    // gather the latencies by call type
+    long replay_ns = 0;
+    long max_lag_ns = 0;
+    unsigned long errors = 0;
+    long* latencies[NR_CALL_TYPES + 1];
+    long counts[NR_CALL_TYPES + 1] = { 0 };
+    unsigned long type_errors[NR_CALL_TYPES + 1] = { 0 };
+    for (int t = 0; t <= NR_CALL_TYPES; t++) {
+        latencies[t] = malloc((nr_calls + 1) * sizeof(long));
+        if (!latencies[t]) {
+            perror("latency array allocation failed");
+            return EXIT_FAILURE;
+        }
+    }
+    for (long i=0; i<threads; i++) {
+        struct per_thread_info* info = &thread_infos[i];
+        for (long c = 0; c < info->nr_calls; c++) {
+            enum call_type type = info->calls[c].type;
+            if (info->call_ns[c] < 0) {
+                type_errors[type]++;
+                type_errors[NR_CALL_TYPES]++;
+                continue;
+            }
+            latencies[type][counts[type]++] = info->call_ns[c];
+            latencies[NR_CALL_TYPES][counts[NR_CALL_TYPES]++] = info->call_ns[c];
+        }
+        if (info->done_ns > replay_ns) replay_ns = info->done_ns;
+        if (info->max_lag_ns > max_lag_ns) max_lag_ns = info->max_lag_ns;
+        errors += info->errors;
+        printf("tid %ld replayed %ld calls, %lu failed or landed elsewhere, in %ld us\n", i, info->nr_calls, info->errors, info->done_ns / 1000);
+    }
+
+    long stats[NR_CALL_TYPES + 1][5];   // total, mean, p50, p99, max
+    printf("\nreplayed %ld calls in %ld us, %lu errors\n", nr_calls, replay_ns / 1000, errors);
+    if (faithful) {
+        printf("latest call started %ld us behind its recorded time\n", max_lag_ns / 1000);
+    }
+    printf("\n%10s %10s %8s %10s %10s %10s %10s\n", "call", "count", "errors", "mean ns", "p50 ns", "p99 ns", "max ns");
+    for (int t = 0; t <= NR_CALL_TYPES; t++) {
+        long n = counts[t];
+        long total = 0;
+        qsort(latencies[t], n, sizeof(long), compare_long);
+        for (long i = 0; i < n; i++) {
+            total += latencies[t][i];
+        }
+        stats[t][0] = total;
+        stats[t][1] = n ? total / n : 0;
+        stats[t][2] = n ? latencies[t][n / 2] : 0;
+        stats[t][3] = n ? latencies[t][(n * 99) / 100] : 0;
+        stats[t][4] = n ? latencies[t][n - 1] : 0;
+        printf("%10s %10ld %8lu %10ld %10ld %10ld %10ld\n", t < NR_CALL_TYPES ? call_names[t] : "all", n, type_errors[t],
+            stats[t][1], stats[t][2], stats[t][3], stats[t][4]);
+    }
+
+    printf("\nreplay complete\n");
+
+    // output statistics
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s", trace);
+    char* dot = strrchr(name, '.');
+    if (dot && dot != name) *dot = '\0';
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "result-microbenchmark-replay-%s-%s-%s-%s.csv",
+        basename(name), faithful ? "faithful" : "fast", smokewagon ? "smokewagon" : "inactive", u.release);
+
+    printf("opening %s\n", filename);
+    FILE *fptr = fopen(filename, "w");
+    if(fptr == NULL) {
+        perror("file opening error!");
+        return EXIT_FAILURE;
+    }
+
+    // replay_ns is the whole replay's wall time, the same on every row
+    fprintf(fptr, "call,count,errors,total_ns,mean_ns,p50_ns,p99_ns,max_ns,replay_ns\n");
+    for (int t = 0; t <= NR_CALL_TYPES; t++) {
+        fprintf(fptr, "%s, %ld, %lu, %ld, %ld, %ld, %ld, %ld, %ld\n", t < NR_CALL_TYPES ? call_names[t] : "all", counts[t], type_errors[t],
+            stats[t][0], stats[t][1], stats[t][2], stats[t][3], stats[t][4], replay_ns);
+    }
+    fclose(fptr);
+    printf("totals written to %s\n", filename);
+
+    for (int t = 0; t <= NR_CALL_TYPES; t++) {
+        free(latencies[t]);
+    }
+    for (long i=0; i<threads; i++) {
+        pthread_attr_destroy(&thread_infos[i].attr);
+        free(thread_infos[i].calls);
+        free(thread_infos[i].call_ns);
+    }
+    free(thread_infos);
+
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
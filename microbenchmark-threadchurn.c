@@ -0,0 +1,354 @@
+/* microbenchmark-threadchurn.c - each thread creates, runs, and joins short-lived threads
+ *
+ * like an elastic worker pool, 1..t churner threads each loop on pthread_create()+exit+pthread_join().
+ * every child gets a freshly mmapped stack (optionally marked MADV_PRIVATE_TLB) that it faults in and
+ * the churner munmaps after joining, so each cycle tears down a stack mapping while -b bystander
+ * threads (1 by default) keep using the same mm on cpus no churner runs on, when there are enough.
+ * each bystander sweeps its own page, checking every word still holds the stamp it wrote there on
+ * the previous sweep before writing the next one, so churn that disturbs its translations shows up.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>     // for ULONG_MAX, PATH_MAX
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>     // getopt guide: https://azrael.digipen.edu/~mmead/www/mg/getopt/index.html
+#include <ctype.h>      // for isdigit()
+#include <sched.h>
+#include <sys/utsname.h> // for uname syscall
+
+#define PAGE_SIZE   4096
+#define STACK_SIZE  (64 * 1024)
+#define STACK_TOUCH (4 * PAGE_SIZE)   // how much of its stack each child faults in
+#define MADV_PRIVATE_TLB 26
+
+struct __attribute__ ((aligned (64))) per_thread_info {
+    int tid;
+    pthread_t thread;
+    pthread_attr_t attr;
+    cpu_set_t cpuset;
+    unsigned long counter;          // churner: create-exit-join cycles, bystander: page writes
+    unsigned long errors;
+    unsigned long total_ns;
+    unsigned long min_ns;
+    unsigned long max_ns;
+    unsigned long* my_page;         // bystanders only
+};
+
+long threads = 4;
+long bystanders = 1;
+long duration = 5;
+long nr_cpus;
+long end;
+
+bool smokewagon = false;
+bool glibc_stacks = false;          // let glibc allocate (and cache) stacks instead of mmapping our own
+atomic_bool stop;
+
+static long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+void* child(void* arg) {
+    // fault in the top of our stack so it has TLB entries to tear down
+    volatile char buf[STACK_TOUCH];
+    for (long i = 0; i < STACK_TOUCH; i += PAGE_SIZE) {
+        buf[i] = 'x';
+    }
+    return buf[0] == 'x' ? arg : NULL;
+}
+
+void* churn(void* info_ptr) {
+    struct per_thread_info* my_info = info_ptr;
+    int tid = my_info->tid;
+    pthread_attr_t attr;
+    pthread_t thread;
+    void* ret;
+    long now;
+
+    // children run on our cpu
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &my_info->cpuset);
+    if (glibc_stacks) {
+        pthread_attr_setstacksize(&attr, STACK_SIZE);
+    }
+
+    do {
+        long before = now_ns();
+
+        char* stack = NULL;
+        if (!glibc_stacks) {
+            stack = mmap(NULL, STACK_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_STACK, -1, 0);
+            if (stack == MAP_FAILED) {
+                printf("stack mmap() for tid: %d failed: %s\n", tid, strerror(errno));
+                break;
+            }
+            if (smokewagon && madvise(stack, STACK_SIZE, MADV_PRIVATE_TLB)) {
+                printf("madvise() for tid: %d failed: %s\n", tid, strerror(errno));
+                munmap(stack, STACK_SIZE);
+                break;
+            }
+            pthread_attr_setstack(&attr, stack, STACK_SIZE);
+        }
+
+        int result = pthread_create(&thread, &attr, child, my_info);
+        if (result) {
+            printf("ERROR: return code for tid %d from pthread_create() is %d\n", tid, result);
+            if (stack) munmap(stack, STACK_SIZE);
+            break;
+        }
+        pthread_join(thread, &ret);
+        if (ret != my_info) {
+            my_info->errors++;
+        }
+
+        if (stack) {
+            munmap(stack, STACK_SIZE);
+        }
+
+        now = now_ns();
+        unsigned long ns = now - before;
+        my_info->total_ns += ns;
+        if (ns < my_info->min_ns) my_info->min_ns = ns;
+        if (ns > my_info->max_ns) my_info->max_ns = ns;
+        my_info->counter++;
+    } while (end > now);
+
+    pthread_attr_destroy(&attr);
+    return info_ptr;
+}
+
+void* bystand(void* info_ptr) {
+    struct per_thread_info* my_info = info_ptr;
+    unsigned long local_counter = 0;
+    const unsigned long words = PAGE_SIZE / sizeof(unsigned long);
+    unsigned long tag = (unsigned long) my_info->tid << 48;
+
+    // sweep 0's stamp, so the first sweep has something to check
+    for (unsigned long i = 0; i < words; i++) {
+        my_info->my_page[i] = tag;
+    }
+
+    // keep using the mm until the churners are done, and make sure every word still holds what the
+    // previous sweep wrote, a whole page of churn ago
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        unsigned long i = local_counter % words;
+        unsigned long sweep = local_counter / words + 1;
+        if (my_info->my_page[i] != (tag | (sweep - 1))) {
+            printf("uhoh, bystander tid: %d expected stamp %lu at word %lu but read %lu\n",
+                my_info->tid, tag | (sweep - 1), i, my_info->my_page[i]);
+            my_info->errors++;
+            break;
+        }
+        my_info->my_page[i] = tag | sweep;
+        local_counter++;
+    }
+    my_info->counter = local_counter;
+
+    return info_ptr;
+}
+
+int main(int argc, char *argv[]) {
+    bool failed = false;
+
+    // check opts
+    int opt;
+    while ((opt = getopt(argc, argv, "gst:b:d:")) != -1) {
+        switch(opt) {
+            case 't':
+            case 'b':
+            case 'd':
+                for (char *p = optarg; *p; p++) {
+                    if (!isdigit(*p)) {
+                        printf("Error: -%c requires a positive integer\n", opt);
+                        return EXIT_FAILURE;
+                    }
+                }
+                if (opt == 't') {
+                    int opt_threads = atoi(optarg);
+                    if (opt_threads > 0) {
+                        threads = opt_threads;
+                    } else {
+                        printf("Error: -t is %d, but should be at least 1, defaulting to 4\n", opt_threads);
+                    }
+                } else if (opt == 'b') {
+                    bystanders = atol(optarg);
+                } else {
+                    duration = atoi(optarg);
+                }
+                break;
+            case 's':
+                smokewagon = true;
+                break;
+            case 'g':
+                glibc_stacks = true;
+                break;
+        }
+    }
+    if (smokewagon && glibc_stacks) {
+        printf("-s marks our own stacks, so it can't be used with glibc-allocated stacks (-g)\n");
+        return EXIT_FAILURE;
+    }
+
+    nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    struct per_thread_info* thread_infos = aligned_alloc(64, (threads + bystanders) * sizeof(struct per_thread_info));
+    struct per_thread_info* bystander_infos = thread_infos + threads;
+    unsigned long* cycles = calloc(threads, sizeof(unsigned long));
+    unsigned long (*cycle_ns)[3] = calloc(threads, sizeof(*cycle_ns));     // avg, min, max
+    unsigned long* bystander_loops = calloc(threads, sizeof(unsigned long));
+    if (!thread_infos || !cycles || !cycle_ns || !bystander_loops) {
+        perror("thread state allocation failed");
+        return EXIT_FAILURE;
+    }
+    memset(thread_infos, 0, (threads + bystanders) * sizeof(struct per_thread_info));
+
+    printf("thread churn microbenchmark, testing from 1 to %ld churning threads with %ld bystanders for %ld seconds each\n", threads, bystanders, duration);
+    printf("stacks: %s\n\n", glibc_stacks ? "glibc" : smokewagon ? "mmap + MADV_PRIVATE_TLB" : "mmap");
+
+    // get and print uname
+    struct utsname u;
+    if (uname(&u) == -1) {
+        perror("uname\n");
+        return EXIT_FAILURE;
+    }
+    printf("running on: %s %s %s %s %s\n",
+        u.sysname,
+        u.nodename,
+        u.release,
+        u.version,
+        u.machine);
+
+    // churners take cpus from 0 up. bystanders get the cpus above every churner's if there are
+    // enough, otherwise they take them from the top down and share
+    bool bystanders_apart = threads + bystanders <= nr_cpus;
+    if (bystanders && !bystanders_apart) {
+        printf("%ld churners and %ld bystanders don't fit on %ld cpus, bystanders will share cpus with churners\n",
+            threads, bystanders, nr_cpus);
+    }
+    for (long i=0; i<threads; i++) {
+        thread_infos[i].tid = i;
+        CPU_ZERO(&thread_infos[i].cpuset);
+        CPU_SET(i % nr_cpus, &thread_infos[i].cpuset);
+        pthread_attr_init(&thread_infos[i].attr);
+        pthread_attr_setaffinity_np(&thread_infos[i].attr, sizeof(cpu_set_t), &thread_infos[i].cpuset);
+    }
+    for (long i=0; i<bystanders; i++) {
+        bystander_infos[i].tid = threads + i;
+        bystander_infos[i].my_page = mmap(NULL, PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (bystander_infos[i].my_page == MAP_FAILED) {
+            printf("bystander mmap() failed: %s\n", strerror(errno));
+            return -1;
+        }
+        CPU_ZERO(&bystander_infos[i].cpuset);
+        CPU_SET(bystanders_apart ? threads + i : nr_cpus - 1 - i % nr_cpus, &bystander_infos[i].cpuset);
+        pthread_attr_init(&bystander_infos[i].attr);
+        pthread_attr_setaffinity_np(&bystander_infos[i].attr, sizeof(cpu_set_t), &bystander_infos[i].cpuset);
+    }
+
+    printf("\nbegin benchmarking\n\n");
+
+    for (long t=0; t<threads; t++) {
+        for (long i=0; i<=t; i++) {
+            thread_infos[i].counter = 0;
+            thread_infos[i].errors = 0;
+            thread_infos[i].total_ns = 0;
+            thread_infos[i].min_ns = ULONG_MAX;
+            thread_infos[i].max_ns = 0;
+        }
+        for (long i=0; i<bystanders; i++) {
+            bystander_infos[i].counter = 0;
+            bystander_infos[i].errors = 0;
+        }
+
+        printf("Running %s create-exit-join loop with %ld threads for %ld seconds:\n", smokewagon ? "smokewagon" : "inactive", t+1, duration);
+
+        atomic_store(&stop, false);
+        for (long i=0; i<bystanders; i++) {
+            int ret = pthread_create(&bystander_infos[i].thread, &bystander_infos[i].attr, bystand, &bystander_infos[i]);
+            if (ret) printf("ERROR: return code for bystander %ld from pthread_create() is %d\n", i, ret);
+        }
+
+        end = now_ns() + duration * 1000000000L;
+        for (long i=0; i<=t; i++) {
+            int ret = pthread_create(&thread_infos[i].thread, &thread_infos[i].attr, churn, &thread_infos[i]);
+            if (ret) printf("ERROR: return code for thread %ld from pthread_create() is %d\n", i, ret);
+        }
+        for (long i=0; i<=t; i++) {
+            pthread_join(thread_infos[i].thread, NULL);
+        }
+
+        atomic_store(&stop, true);
+        for (long i=0; i<bystanders; i++) {
+            pthread_join(bystander_infos[i].thread, NULL);
+            bystander_loops[t] += bystander_infos[i].counter;
+            if (bystander_infos[i].errors) {
+                printf("uhoh, bystander %ld found %lu stale stamps on its page\n", i, bystander_infos[i].errors);
+                failed = true;
+            }
+        }
+
+        unsigned long total_ns = 0;
+        cycle_ns[t][1] = ULONG_MAX;
+        for (long i=0; i<=t; i++) {
+            cycles[t] += thread_infos[i].counter;
+            total_ns += thread_infos[i].total_ns;
+            if (thread_infos[i].min_ns < cycle_ns[t][1]) cycle_ns[t][1] = thread_infos[i].min_ns;
+            if (thread_infos[i].max_ns > cycle_ns[t][2]) cycle_ns[t][2] = thread_infos[i].max_ns;
+            if (thread_infos[i].errors) {
+                printf("uhoh, tid %ld had %lu children return garbage\n", i, thread_infos[i].errors);
+                failed = true;
+            }
+            printf("tid %ld performed %lu cycles\n", i, thread_infos[i].counter);
+        }
+        if (cycles[t] == 0) cycle_ns[t][1] = 0;
+        cycle_ns[t][0] = cycles[t] ? total_ns / cycles[t] : 0;
+        printf("%ld threads performed %lu cycles, avg %lu ns, min %lu ns, max %lu ns, bystanders performed %lu loops.\n\n",
+            t+1, cycles[t], cycle_ns[t][0], cycle_ns[t][1], cycle_ns[t][2], bystander_loops[t]);
+    }
+
+    printf("microbenchmarking complete\n");
+
+    for (long i=0; i<threads + bystanders; i++) {
+        pthread_attr_destroy(&thread_infos[i].attr);
+    }
+    for (long i=0; i<bystanders; i++) {
+        munmap(bystander_infos[i].my_page, PAGE_SIZE);
+    }
+
+    // output statistics
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "result-microbenchmark-threadchurn-%s-%s.csv",
+        glibc_stacks ? "glibcstacks" : smokewagon ? "smokewagon" : "inactive", u.release);
+
+    printf("opening %s\n", filename);
+    FILE *fptr = fopen(filename, "w");
+    if(fptr == NULL) {
+        perror("file opening error!");
+        return EXIT_FAILURE;
+    }
+
+    fprintf(fptr, "threads,bystanders,cycles,avg_cycle_ns,min_cycle_ns,max_cycle_ns,bystander_loops\n");
+    for (long t=0; t<threads; t++) {
+        fprintf(fptr, "%ld, %ld, %lu, %lu, %lu, %lu, %lu\n", t+1, bystanders, cycles[t], cycle_ns[t][0], cycle_ns[t][1], cycle_ns[t][2], bystander_loops[t]);
+    }
+    fclose(fptr);
+    printf("totals written to %s\n", filename);
+
+    free(cycles);
+    free(cycle_ns);
+    free(bystander_loops);
+    free(thread_infos);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,707 @@
+/* microbenchmark.c - run any registered workload on 1..t threads for d seconds each
+ *
+ * build: gcc -O2 -pthread -o microbenchmark microbenchmark.c record.c sampler.c tracefs.c noise.c workload-*.c
+ * usage: ./microbenchmark -w mmap-membacked -t 64 -s
+ *
+ * every thread gets its own GB-aligned 1 GB region, is placed on a cpu (pinned round-robin, or
+ * floating with -F, -o threads per cpu), and calls the workload's op until time runs out. the loops
+ * every thread performed are summed and written to result-microbenchmark-<workload>-<hash>.csv,
+ * with "smokewagon" or "inactive" after the workload's family name, and "-<n>pages" after the hash
+ * when -p makes every op work on n pages instead of one. -l lists the workloads.
+ *
+ * each run also appends one self-describing JSON record (config, kernel, machine, THP, smokewagon
+ * probe, per-thread counts) to result-microbenchmark.jsonl, or wherever -j says. with -i ms, the
+ * record also carries every thread's loop count sampled every ms milliseconds, and with -I the
+ * TLB shootdown and function call IPIs so far at each sample. -T (as root, with tracefs mounted)
+ * traces every TLB flush during each run and records counts per flush reason and cpu, along with a
+ * histogram of how many pages each flush covered.
+ *
+ * with -P every worker is a forked process instead of a thread, with the same placement, region, and
+ * setup, and its counts come back through shared memory. separate processes have separate mms, so
+ * nothing one does needs flushing on another's cpu: that's the ceiling private TLBs are reaching for.
+ * result files get "-processes" after the hash. every worker, thread or process, waits at a start gate
+ * until all of them exist, so each gets the full -d seconds, and -P's parent sits on the spare cpu
+ * (or floats, if there isn't one) instead of next to worker 0.
+ *
+ * file-backed workloads put their files in -D's directory (the current one by default), and the
+ * record says which file and filesystem were behind the first thread's mapping. the scan workloads
+ * stream through one -z MiB file there, -p pages at a time.
+ *
+ * -N is the low-noise mode (see noise.c): the harness is mlocked, -R prio runs the workers
+ * SCHED_FIFO (one pinned per cpu, so not with -o above 1 or -F), and every cpu's noise floor is
+ * measured before benchmarking and kept in every record. cpus noisier than -J percent (1 by
+ * default) are flagged, and so is every run that uses one.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/vfs.h>    // for fstatfs()
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>     // getopt guide: https://azrael.digipen.edu/~mmead/www/mg/getopt/index.html
+#include <ctype.h>      // for isdigit()
+#include <sched.h>
+#include <sys/utsname.h> // for uname syscall
+#include <stdint.h> // for uintptr_t
+#include <limits.h> // for PATH_MAX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "microbenchmark.h"
+
+const struct workload* workloads[] = {
+    &workload_mmap_private,
+    &workload_mmap_membacked,
+    &workload_mmap_memfd,
+    &workload_mmap_shmem,
+    &workload_mmap_filebacked,
+    &workload_mprotect_shootdown,
+    &workload_mprotect_noprotchange,
+    &workload_scan_mmap,
+    &workload_scan_mmap_populate,
+    &workload_scan_mmap_sequential,
+    &workload_scan_pread,
+    &workload_scan_uring,
+    NULL,
+};
+
+const struct workload* workload = &workload_mmap_membacked;
+
+const char* kernel_hash_opt = NULL;             // -k, otherwise see probe_system()
+const char* record_path = "result-microbenchmark.jsonl";
+
+long min_threads = 1;
+long threads = 4;
+long duration = 5;
+long end;
+long nr_cpus;       // online cpus
+long per_cpu = 1;   // threads per cpu, > 1 oversubscribes
+bool floating = false; // float threads across the cpus in use instead of pinning them round-robin
+bool processes = false; // -P, fork a process per worker instead of a thread
+
+long pages = 1;     // pages per op, the workload decides what that means
+const char* file_dir = ".";
+long file_mib = 1024;
+bool smokewagon = false; // smokewagon == false means don't use smokewagon, smokewagon == true means use smokewagon
+
+// workers wait here until every one of them exists, then all get the same measured time. it's in
+// shared memory so -P's workers can wait on it too
+struct start_gate {
+    _Atomic long ready;
+    _Atomic uint32_t go;        // futex word
+    long end;
+};
+struct start_gate* gate;
+
+struct live_counter* live;  // one per thread, for the sampler
+struct sampler sampler = { .interval_ms = 0 }; // -i turns it on
+bool trace_flushes = false; // -T
+struct flush_trace flush_trace;
+bool low_noise = false;     // -N
+struct noise noise = { .calibration_ms = 100, .threshold_pct = 1.0 };
+
+// not private futexes, -P's workers are separate processes
+void wait_for_start(void) {
+    atomic_fetch_add(&gate->ready, 1);
+    while (!atomic_load(&gate->go)) {
+        syscall(SYS_futex, &gate->go, FUTEX_WAIT, 0, NULL, NULL, 0);
+    }
+    if (processes) {
+        end = gate->end; // our own copy of it, the parent's was set after we forked
+    }
+}
+
+void open_gate(long workers) {
+    while (atomic_load(&gate->ready) < workers) {
+        usleep(100);
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    end = now.tv_sec * 1000000000L + now.tv_nsec + duration * 1000000000L;
+    assert(end > now.tv_sec * 1000000000L + now.tv_nsec); // check overflow
+    gate->end = end;
+    atomic_store(&gate->go, 1);
+    syscall(SYS_futex, &gate->go, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+void* run_workload(void* info_ptr) {
+    struct per_thread_info* my_info = info_ptr;
+    struct live_counter* my_live = &live[my_info->tid];
+    unsigned long local_counter = 0;
+    struct timespec now;
+
+    do {
+        if (workload->op(my_info, local_counter)) {
+            my_info->errors++;
+            break;
+        }
+
+        local_counter++;
+        atomic_store_explicit(&my_live->loops, local_counter, memory_order_relaxed);
+
+        // check time
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ( end > now.tv_sec * 1000000000L + now.tv_nsec );
+
+    my_info->counter = local_counter;
+
+    return info_ptr;
+}
+
+void* run_worker(void* info_ptr) {
+    wait_for_start();
+    return run_workload(info_ptr);
+}
+
+// a worker process: run in its own copy of the address space, and verify there too, since the
+// parent's copy never saw what the worker did
+void run_process(struct per_thread_info* info) {
+    sched_setaffinity(0, sizeof(cpu_set_t), &info->cpuset);
+    noise_fifo_self(&noise, true);
+    run_worker(info);
+    if (workload->verify && !workload->verify(info)) {
+        info->verify_failed = true;
+    }
+    fflush(stdout);
+    _exit(0);
+}
+
+// thread state lives in shared memory, so forked workers' counts get back to us
+void* shared_alloc(size_t size) {
+    void* ptr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+// thread i's affinity while t threads run: ceil(t/per_cpu) cpus are in use, and the thread is
+// either pinned to one of them round-robin or allowed to float across all of them
+void place_thread(cpu_set_t* cpuset, long i, long t) {
+    long cpus = (t + per_cpu - 1) / per_cpu;
+    CPU_ZERO(cpuset);
+    if (floating) {
+        for (long c=0; c<cpus; c++) {
+            CPU_SET(c, cpuset);
+        }
+    } else {
+        CPU_SET(i % cpus, cpuset);
+    }
+}
+
+// parse a positive integer option, or complain and return -1
+long parse_positive(int opt, const char* arg) {
+    for (const char *p = arg; *p; p++) {
+        if (!isdigit(*p)) {
+            printf("Error: -%c requires a positive integer\n", opt);
+            return -1;
+        }
+    }
+    long value = atol(arg);
+    if (value < 1) {
+        printf("Error: -%c is %ld, but should be at least 1\n", opt, value);
+        return -1;
+    }
+    return value;
+}
+
+int main(int argc, char *argv[]) {
+    // check opts
+    int opt;
+    bool jitter_set = false;
+    while ((opt = getopt(argc, argv, "lsFIPTNw:t:d:m:o:p:k:j:i:D:z:R:J:")) != -1) {
+        switch(opt) {
+            case 'w':
+                workload = NULL;
+                for (int i=0; workloads[i]; i++) {
+                    if (!strcmp(optarg, workloads[i]->name)) {
+                        workload = workloads[i];
+                    }
+                }
+                if (!workload) {
+                    printf("Error: no workload named %s, -l lists them\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'l':
+                for (int i=0; workloads[i]; i++) {
+                    printf("%-24s %s\n", workloads[i]->name, workloads[i]->description);
+                }
+                return EXIT_SUCCESS;
+            case 't':
+                if ((threads = parse_positive(opt, optarg)) < 0) return EXIT_FAILURE;
+                break;
+            case 'm':
+                if ((min_threads = parse_positive(opt, optarg)) < 0) return EXIT_FAILURE;
+                break;
+            case 'd':
+                if ((duration = parse_positive(opt, optarg)) < 0) return EXIT_FAILURE;
+                break;
+            case 'o':
+                if ((per_cpu = parse_positive(opt, optarg)) < 0) return EXIT_FAILURE;
+                break;
+            case 'p':
+                if ((pages = parse_positive(opt, optarg)) < 0) return EXIT_FAILURE;
+                break;
+            case 's':
+                smokewagon = true;
+                break;
+            case 'F':
+                floating = true;
+                break;
+            case 'P':
+                processes = true;
+                break;
+            case 'k':
+                kernel_hash_opt = optarg;
+                break;
+            case 'j':
+                record_path = optarg;
+                break;
+            case 'D':
+                file_dir = optarg;
+                break;
+            case 'z':
+                if ((file_mib = parse_positive(opt, optarg)) < 0) return EXIT_FAILURE;
+                break;
+            case 'i':
+                if ((sampler.interval_ms = parse_positive(opt, optarg)) < 0) return EXIT_FAILURE;
+                break;
+            case 'I':
+                sampler.ipis = true;
+                break;
+            case 'T':
+                trace_flushes = true;
+                break;
+            case 'N':
+                low_noise = true;
+                break;
+            case 'R':
+                if ((noise.fifo_priority = parse_positive(opt, optarg)) < 0) return EXIT_FAILURE;
+                break;
+            case 'J':
+                jitter_set = true;
+                noise.threshold_pct = strtod(optarg, NULL);
+                if (noise.threshold_pct <= 0) {
+                    printf("Error: -J is a percentage of the cpu's time, and has to be more than 0\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                printf("usage: %s [-l] [-w workload] [-s] [-t threads] [-m min_threads] [-d seconds] [-o threads_per_cpu] [-F] [-P] [-p pages] [-D file_dir] [-z file_mib] [-k kernel_hash] [-j records.jsonl] [-i sample_ms [-I]] [-T] [-N [-R fifo_priority] [-J jitter_pct]]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (min_threads > threads) {
+        printf("min_threads (-m %ld) can't be larger than threads (-t %ld)\n", min_threads, threads);
+        return EXIT_FAILURE;
+    }
+    if ((unsigned long long) pages >= ONE_GB_SIZE / PAGE_SIZE) {
+        printf("-p %ld pages don't fit in a thread's 1 GB region\n", pages);
+        return EXIT_FAILURE;
+    }
+    if (sampler.ipis && !sampler.interval_ms) {
+        printf("-I samples IPIs along with loop counts, so it needs -i\n");
+        return EXIT_FAILURE;
+    }
+    if (!low_noise && (noise.fifo_priority || jitter_set)) {
+        printf("-R and -J are part of the low-noise mode, so they need -N\n");
+        return EXIT_FAILURE;
+    }
+    // equal-priority SCHED_FIFO never time-slices, so workers sharing a cpu would run one after another
+    if (noise.fifo_priority && (per_cpu > 1 || floating)) {
+        printf("-R needs every worker pinned to a cpu of its own, so it can't be used with -o above 1 or -F\n");
+        return EXIT_FAILURE;
+    }
+
+    nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if ((threads + per_cpu - 1) / per_cpu > nr_cpus) {
+        printf("%ld threads at %ld per cpu need more than the %ld online cpus, try a larger -o\n", threads, per_cpu, nr_cpus);
+        return EXIT_FAILURE;
+    }
+
+    struct per_thread_info* thread_infos = shared_alloc(threads * sizeof(struct per_thread_info));
+    long* results = calloc(threads, sizeof(long));
+    live = shared_alloc(threads * sizeof(struct live_counter));
+    gate = shared_alloc(sizeof(struct start_gate));
+    if (!thread_infos || !results || !live || !gate) {
+        perror("thread state allocation failed");
+        return EXIT_FAILURE;
+    }
+    if (sampler.interval_ms && sampler_init(&sampler, live, threads, duration)) {
+        perror("sampler allocation failed");
+        return EXIT_FAILURE;
+    }
+
+    printf("%s microbenchmark (%s), testing from %ld to %ld threads for %ld seconds each\n", workload->name, workload->description, min_threads, threads, duration);
+    printf("%ld %s per cpu, %s, %ld page(s) per op\n\n", per_cpu, processes ? "process(es)" : "thread(s)", floating ? "floating" : "pinned round-robin", pages);
+
+    if (smokewagon) {
+        printf("smokewagon:  ON\n\n");
+    } else {
+        printf("smokewagon: OFF\n\n");
+    }
+
+    // get and print uname
+    struct utsname u;
+    if (uname(&u) == -1) {
+        perror("uname\n");
+        return EXIT_FAILURE;
+    }
+
+    // describe the kernel and machine before we start poking at them
+    struct system_info sys;
+    probe_system(&sys, kernel_hash_opt);
+
+    printf("running on: %s %s %s %s %s\n",
+        u.sysname,
+        u.nodename,
+        u.release,
+        u.version,
+        u.machine);
+    printf("kernel hash: %s, cpu: %s, %ld cpus in %ld cores and %ld packages, THP %s\n",
+        sys.kernel_hash, sys.cpu_model, sys.online_cpus, sys.cores, sys.packages, sys.thp_enabled);
+    printf("smokewagon probe: MAP_PRIVATE_TLB %s, MADV_PRIVATE_TLB %s, MADV_NORMAL_TLB %s, MADV_PROBE_TLB %s\n",
+        sys.map_private_tlb ? "yes" : "no", sys.madv_private_tlb ? "yes" : "no",
+        sys.madv_normal_tlb ? "yes" : "no", sys.madv_probe_tlb ? "yes" : "no");
+
+    FILE* record = fopen(record_path, "a");
+    if (record == NULL) {
+        perror("record file opening error!");
+        return EXIT_FAILURE;
+    }
+
+    // locks what the harness has mapped so far, so before the workload maps anything
+    if (low_noise && noise_setup(&noise, nr_cpus)) {
+        return EXIT_FAILURE;
+    }
+
+    // before the big mmap and the threads, since this forks the trace reader
+    if (trace_flushes) {
+        if (flush_trace_setup(&flush_trace, nr_cpus, 16384)) {
+            flush_trace_teardown(&flush_trace);
+            return EXIT_FAILURE;
+        }
+        printf("tracing TLB flushes with %s\n", flush_trace.source);
+    }
+
+    // each thread gets its own 1 GB virtual region to avoid page table lock contention
+    // get this by mapping threads+1 GB and then picking aligned pointers from it
+    // we have to faff about because there's no guarantee that big_mmap_ptr is GB-aligned
+    char* big_mmap_ptr = mmap(NULL, ONE_GB_SIZE*(threads+1), PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (big_mmap_ptr == MAP_FAILED || big_mmap_ptr == NULL) {
+        printf("big mmap failed\n");
+        return -1;
+    }
+    // GB-aligned          big_mmap_ptr                              aligned_ptr
+    // |-----unallocated---|----------offset_to_allocated------------|-------big-allocation-goes-on...
+    size_t offset_to_unallocated = (uintptr_t) big_mmap_ptr % ONE_GB_SIZE;
+    size_t offset_to_allocated = (ONE_GB_SIZE - offset_to_unallocated) % ONE_GB_SIZE;
+    char* aligned_ptr = big_mmap_ptr + offset_to_allocated;
+
+    // per-thread preparation
+    for (int i=0; i<threads; i++) {
+        thread_infos[i].tid = i; // assign each thread an id
+
+        // carve off our chunk of the big allocation
+        thread_infos[i].region = aligned_ptr;
+        aligned_ptr += ONE_GB_SIZE;
+
+        // thread_infos starts zeroed and fd 0 is stdin, so no backing file until a workload opens one
+        thread_infos[i].fd = -1;
+
+        if (workload->setup(&thread_infos[i])) {
+            printf("%s setup for tid %d failed\n", workload->name, i);
+            return -1;
+        }
+
+        // cpu affinities depend on how many threads are running, so they're set per run below
+        if (i > 0) {
+            pthread_attr_init(&thread_infos[i].attr);
+            if (low_noise) {
+                thread_infos[i].stack = noise_stack(&noise, &thread_infos[i].attr);
+                noise_fifo_attr(&noise, &thread_infos[i].attr);
+            }
+        }
+    }
+
+    // what's behind file-backed mappings, e.g. "/mnt/scratch/microbenchmark-filebacked-temp-00" on xfs
+    char backing_path[PATH_MAX] = "";
+    const char* backing_fs = NULL;
+    struct statfs backing_statfs;
+    if (thread_infos[0].fd != -1 && fstatfs(thread_infos[0].fd, &backing_statfs) == 0) {
+        char fd_path[64];
+        snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", thread_infos[0].fd);
+        ssize_t len = readlink(fd_path, backing_path, sizeof(backing_path) - 1);
+        backing_path[len > 0 ? len : 0] = '\0';
+        backing_fs = fs_type_name(backing_statfs.f_type);
+        printf("backed by %s on %s (0x%lx)\n", backing_path, backing_fs, (unsigned long) backing_statfs.f_type);
+    }
+
+    printf("\nbegin benchmarking\n\n");
+
+    bool failed = false;
+
+    // main microbenchmarking loops
+    for (long t=min_threads-1; t<threads; t++) {
+        printf("Running %s %s loop with %ld threads for %ld seconds:\n", smokewagon ? "smokewagon" : "inactive", workload->name, t+1, duration);
+
+        // set cpu affinities: https://man7.org/linux/man-pages/man3/pthread_setaffinity_np.3.html
+        for (long i=0; i<=t; i++) {
+            thread_infos[i].errors = 0;
+            place_thread(&thread_infos[i].cpuset, i, t+1);
+            if (i == 0 && !processes) {
+                // set main thread's cpu affinity, which is already running
+                pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &thread_infos[i].cpuset);
+            } else if (i > 0) {
+                // set child threads' cpu affinities, reusing pthread_attr without reinitializing is fine
+                pthread_attr_setaffinity_np(&thread_infos[i].attr, sizeof(cpu_set_t), &thread_infos[i].cpuset);
+            }
+        }
+
+        // the sampler and trace reader get the last cpu if the run leaves it free, otherwise they have to share
+        for (long i=0; i<=t; i++) {
+            atomic_store(&live[i].loops, 0);
+        }
+        long spare_cpu = -1;
+        if ((t + per_cpu) / per_cpu < nr_cpus) { // ceil((t+1)/per_cpu) cpus are in use
+            spare_cpu = nr_cpus - 1;
+        } else if (sampler.interval_ms || trace_flushes) {
+            printf("no spare cpu for the sampler or trace reader, they're floating among the measured ones\n");
+        }
+
+        // -P's parent only forks and waits, so it stays off the measured cpus where it can
+        if (processes) {
+            cpu_set_t parent_cpus;
+            CPU_ZERO(&parent_cpus);
+            for (long c=0; c<nr_cpus; c++) {
+                if (spare_cpu == -1 || c == spare_cpu) CPU_SET(c, &parent_cpus);
+            }
+            sched_setaffinity(0, sizeof(cpu_set_t), &parent_cpus);
+        }
+
+        atomic_store(&gate->ready, 0);
+        atomic_store(&gate->go, 0);
+
+        // fork processes, they wait at the gate until they've all been forked
+        if (processes) {
+            fflush(stdout); // or every child flushes our buffered output again
+            for (long i=0; i<=t; i++) {
+                thread_infos[i].verify_failed = false;
+                // thread_infos is shared, so only the parent may store the pid
+                pid_t pid = fork();
+                if (pid == 0) {
+                    run_process(&thread_infos[i]);
+                }
+                thread_infos[i].pid = pid;
+                if (pid == -1) {
+                    printf("ERROR: fork() for worker %ld failed: %s\n", i, strerror(errno));
+                    thread_infos[i].counter = 0;
+                    thread_infos[i].errors++;
+                    atomic_fetch_add(&gate->ready, 1); // so the others don't wait for it forever
+                }
+            }
+        }
+
+        // create threads, they wait at the gate until they've all been created
+        for (long i=1; !processes && i<=t; i++) {
+            int ret = pthread_create(&thread_infos[i].thread, &thread_infos[i].attr, run_worker, &thread_infos[i]);
+            thread_infos[i].created = ret == 0;
+            if (ret) {
+                printf("ERROR: return code for thread %ld from pthread_create() is %d\n", i, ret);
+                thread_infos[i].counter = 0;
+                thread_infos[i].errors++;
+                atomic_fetch_add(&gate->ready, 1);
+            }
+        }
+
+        // everyone's waiting, so start sampling and tracing, then let them go
+        if (sampler.interval_ms && sampler_start(&sampler, t+1, spare_cpu)) {
+            printf("ERROR: couldn't start the sampler thread\n");
+            return EXIT_FAILURE;
+        }
+        if (trace_flushes && flush_trace_start(&flush_trace, spare_cpu)) {
+            flush_trace_teardown(&flush_trace);
+            return EXIT_FAILURE;
+        }
+
+        // worker 0 is us. the others sleep at the gate until it opens, so we're SCHED_FIFO before any of
+        // them can run, and after the sampler and trace reader were created, so they don't inherit it
+        if (!processes) {
+            noise_fifo_self(&noise, true);
+        }
+        open_gate(processes ? t+1 : t);
+
+        if (processes) {
+            // not wait(), the trace reader is our child too
+            for (long i=0; i<=t; i++) {
+                int status;
+                if (thread_infos[i].pid == -1) continue;
+                if (waitpid(thread_infos[i].pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+                    printf("ERROR: worker process %ld died\n", i);
+                    thread_infos[i].errors++;
+                }
+            }
+        }
+
+        if (!processes) {
+            run_workload(&thread_infos[0]);
+            noise_fifo_self(&noise, false);
+        }
+
+        // join created threads
+        for (long i=1; !processes && i<=t ;i++) {
+            if (!thread_infos[i].created) continue;
+            pthread_join(thread_infos[i].thread, NULL);
+        }
+
+        if (sampler.interval_ms) {
+            sampler_stop(&sampler);
+            double min_rate, max_rate;
+            sampler_summary(&sampler, end, &min_rate, &max_rate);
+            printf("%ld samples every %ld ms, slowest interval %.0f loops/s, fastest %.0f loops/s\n",
+                sampler.nr_samples, sampler.interval_ms, min_rate, max_rate);
+        }
+        if (trace_flushes) {
+            flush_trace_stop(&flush_trace);
+            flush_trace_print(&flush_trace);
+        }
+
+        // did the run land on any cpu calibration found noisy
+        char jittery[256] = "";
+        if (low_noise) {
+            cpu_set_t used;
+            CPU_ZERO(&used);
+            for (long i=0; i<=t; i++) {
+                CPU_OR(&used, &used, &thread_infos[i].cpuset);
+            }
+            noise_jittery(&noise, &used, jittery, sizeof(jittery));
+            if (jittery[0]) {
+                printf("uhoh, this run used jittery cpus: %s\n", jittery);
+            }
+        }
+
+        // sum counters from each thread, and make sure nothing went wrong
+        unsigned long errors = 0;
+        for (long i=0; i<=t; i++) {
+            bool verify_failed = processes ? thread_infos[i].verify_failed : workload->verify && !workload->verify(&thread_infos[i]);
+            if (verify_failed) {
+                printf("uhoh, tid %ld failed %s verification\n", i, workload->name);
+                thread_infos[i].errors++;
+            }
+            errors += thread_infos[i].errors;
+            results[t] += thread_infos[i].counter;
+            printf("tid %ld performed %lu loops\n", i, thread_infos[i].counter);
+        }
+        printf("%ld %s performed %ld %s loops in %ld seconds.\n\n", t+1, processes ? "processes" : "threads", results[t], smokewagon ? "smokewagon" : "inactive", duration);
+        if (errors) {
+            printf("uhoh, %lu errors with %ld threads\n\n", errors, t+1);
+            failed = true;
+        }
+
+        // one line per run, so a crash later on doesn't lose it
+        fprintf(record, "{\"benchmark\": \"microbenchmark\", \"timestamp\": %ld, \"workload\": ", (long) time(NULL));
+        json_string(record, workload->name);
+        fprintf(record, ", \"config\": {\"smokewagon\": %s, \"threads\": %ld, \"duration_s\": %ld, \"threads_per_cpu\": %ld, \"placement\": \"%s\", \"pages\": %ld, \"workers\": \"%s\", \"file_mib\": %ld}, ",
+            smokewagon ? "true" : "false", t+1, duration, per_cpu, floating ? "floating" : "pinned", pages, processes ? "processes" : "threads", file_mib);
+        write_system(record, &sys);
+        if (backing_fs) {
+            fprintf(record, ", \"backing\": {\"path\": ");
+            json_string(record, backing_path);
+            fprintf(record, ", \"fs\": \"%s\", \"magic\": \"0x%lx\"}", backing_fs, (unsigned long) backing_statfs.f_type);
+        }
+        fprintf(record, ", \"loops\": %ld, \"errors\": %lu, \"per_thread\": [", results[t], errors);
+        for (long i=0; i<=t; i++) {
+            fprintf(record, "%s{\"tid\": %ld, \"cpus\": \"", i ? ", " : "", i);
+            for (long c=0, first=1; c<nr_cpus; c++) {
+                if (CPU_ISSET(c, &thread_infos[i].cpuset)) {
+                    fprintf(record, "%s%ld", first ? "" : ",", c);
+                    first = 0;
+                }
+            }
+            fprintf(record, "\", \"loops\": %lu, \"errors\": %lu}", thread_infos[i].counter, thread_infos[i].errors);
+        }
+        fprintf(record, "]");
+        if (sampler.interval_ms) {
+            fprintf(record, ", ");
+            sampler_write(record, &sampler);
+        }
+        if (trace_flushes) {
+            fprintf(record, ", ");
+            flush_trace_write(record, &flush_trace);
+        }
+        if (low_noise) {
+            fprintf(record, ", ");
+            noise_write(record, &noise, jittery);
+        }
+        fprintf(record, "}\n");
+        fflush(record);
+    }
+
+    fclose(record);
+    printf("records appended to %s\n", record_path);
+
+    printf("microbenchmarking complete\n");
+
+    // cleanup loop
+    for (int i=0; i<threads; i++) {
+        if (workload->teardown) {
+            workload->teardown(&thread_infos[i]);
+        }
+    }
+    munmap(big_mmap_ptr, ONE_GB_SIZE*(threads+1));
+    printf("workload torn down\n\n");
+
+    // output statistics: result-microbenchmark-<family>-<smokewagon|inactive>-<variant>-<hash>[-<n>pages][-processes].csv
+    const char* variant = strchr(workload->name, '-');
+    int family_length = variant ? variant - workload->name : (int) strlen(workload->name);
+    char pages_suffix[32] = "";
+    if (pages != 1) {
+        snprintf(pages_suffix, sizeof(pages_suffix), "-%ldpages", pages);
+    }
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "result-microbenchmark-%.*s-%s%s-%s%s%s.csv",
+        family_length, workload->name, smokewagon ? "smokewagon" : "inactive", variant ? variant : "", sys.kernel_hash, pages_suffix,
+        processes ? "-processes" : "");
+
+    printf("opening %s\n", filename);
+    FILE *fptr = fopen(filename, "w");
+    if(fptr == NULL) {
+        perror("file opening error!");
+        return EXIT_FAILURE;
+    }
+
+    fprintf(fptr, "threads,loops\n");
+    for (long t=0; t<threads; t++) {
+        fprintf(fptr, "%ld, %ld\n", t+1, results[t]);
+    }
+    fclose(fptr);
+    printf("totals written to %s\n", filename);
+
+    /* don't destroy pthread_attr for t=0, since we didn't initialize it */
+    for (long t=1; t<threads; t++) {
+        pthread_attr_destroy(&thread_infos[t].attr);
+        noise_free_stack(thread_infos[t].stack);
+    }
+    printf("pthread attributes destroyed\n");
+
+    if (sampler.interval_ms) {
+        sampler_free(&sampler);
+    }
+    if (trace_flushes) {
+        flush_trace_teardown(&flush_trace);
+    }
+    if (low_noise) {
+        noise_free(&noise);
+    }
+    munmap(live, threads * sizeof(struct live_counter));
+    free(results);
+    munmap(thread_infos, threads * sizeof(struct per_thread_info));
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
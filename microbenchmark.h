@@ -0,0 +1,205 @@
+/* microbenchmark.h - what the microbenchmark driver and its workloads share
+ *
+ * a workload is a handful of callbacks the driver calls for every thread: setup once before any run,
+ * op over and over while the clock runs, verify after each run, and teardown at the end. the driver
+ * owns options, thread placement, timing, result summation, and output, so all of it applies to
+ * every workload. to add one, define a struct workload in a workload-*.c file, declare it at the
+ * bottom of this header, and list it in workloads[] in microbenchmark.c.
+ */
+
+#ifndef MICROBENCHMARK_H
+#define MICROBENCHMARK_H
+
+// like every file here, includers #define _GNU_SOURCE first, for cpu_set_t
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define ONE_GB_SIZE (1ULL << 30)
+#define HUGEPAGE_SIZE 2097152
+#define PAGE_SIZE   4096
+#define MAP_PRIVATE_TLB 0x200000
+#define MADV_PRIVATE_TLB 26
+#define MADV_NORMAL_TLB 27
+
+struct __attribute__ ((aligned (64))) per_thread_info {
+    int tid;
+    pthread_t thread;
+    pid_t pid;                  // -P, the worker process
+    pthread_attr_t attr;
+    cpu_set_t cpuset;
+    unsigned long counter;
+    unsigned long errors;       // bumped by workloads when they read something they shouldn't
+    bool created;               // pthread_create() worked, so there is a thread to join
+    char* region;               // this thread's own GB-aligned 1 GB of PROT_NONE address space
+    char* my_page;
+    char* bystander_page;
+    int fd;                     // -1 unless the workload opened a backing file
+    bool verify_failed;         // -P: the worker process ran verify itself, in its own mm
+    void* workload_data;        // anything else the workload keeps per thread
+    void* stack;                // -N, its mlocked stack
+};
+
+struct workload {
+    const char* name;           // "<family>-<variant>", result files are named after it
+    const char* description;
+    int (*setup)(struct per_thread_info* info);                             // once per thread, untimed, nonzero fails
+    int (*op)(struct per_thread_info* info, unsigned long iteration);       // timed, nonzero stops the thread
+    bool (*verify)(struct per_thread_info* info);                           // after each run, optional
+    void (*teardown)(struct per_thread_info* info);                         // at exit, optional
+};
+
+// driver options workloads may look at
+extern bool smokewagon;
+extern long pages;              // -p, how many pages each op works on
+extern const char* file_dir;    // -D, where file-backed workloads put their files
+extern long file_mib;           // -z, how big a file scanning workloads scan
+extern long threads;            // -t, the most threads any run will have
+
+// where a run happened, see record.c
+struct system_info {
+    char hostname[65];
+    char release[65];
+    char machine[65];
+    char proc_version[512];
+    char kernel_hash[128];
+    char build_id[64];
+    char cpu_model[128];
+    long online_cpus;
+    char online_list[256];
+    long cores;
+    long packages;
+    char numa_nodes[256];
+    char thp_enabled[32];
+    char thp_defrag[32];
+    bool map_private_tlb;
+    bool madv_private_tlb;
+    bool madv_normal_tlb;
+    bool madv_probe_tlb;
+};
+
+void json_string(FILE* f, const char* s);
+void probe_system(struct system_info* info, const char* kernel_hash);
+void write_system(FILE* f, const struct system_info* info);
+const char* fs_type_name(unsigned long magic);
+
+// a worker's running loop count, alone in its cache line so the sampler reading it doesn't
+// drag anything else of the worker's along
+struct __attribute__ ((aligned (64))) live_counter {
+    _Atomic unsigned long loops;
+};
+
+// see sampler.c
+struct sampler {
+    long interval_ms;
+    bool ipis;                  // also sample TLB shootdown and function call IPI totals
+    long nr_threads;
+    long start_ns;
+    long max_samples;
+    long nr_samples;
+    long dropped;               // samples that didn't fit, the final one always does
+    long* t_ns;                 // [max_samples], since start_ns
+    unsigned long* loops;       // [max_samples][nr_threads], cumulative
+    unsigned long* tlb_ipis;    // [max_samples], since start_ns
+    unsigned long* call_ipis;
+    unsigned long tlb_base;
+    unsigned long call_base;
+    struct live_counter* live;
+    pthread_t thread;
+    _Atomic bool stop;
+};
+
+unsigned long read_interrupts(const char* name);
+int sampler_init(struct sampler* s, struct live_counter* live, long max_threads, long duration);
+int sampler_start(struct sampler* s, long nr_threads, long cpu);
+void sampler_stop(struct sampler* s);
+void sampler_summary(const struct sampler* s, long end_ns, double* min_rate, double* max_rate);
+void sampler_write(FILE* f, const struct sampler* s);
+void sampler_free(struct sampler* s);
+
+// see tracefs.c
+#define FLUSH_REASONS 16        // distinct tlb_flush reasons, or kprobed functions
+#define FLUSH_BUCKETS 24        // log2(pages) buckets, the last for full flushes
+
+// shared with the trace reader process
+struct flush_counts {
+    _Atomic bool quit;
+    _Atomic long cpu;                       // where the reader should sit this run, -1 anywhere
+    _Atomic unsigned long generation;       // bumped every run
+    _Atomic unsigned long drain;            // bumped when we want everything so far parsed
+    _Atomic unsigned long drained;          // the last drain the reader finished
+    int nr_reasons;
+    char reasons[FLUSH_REASONS][32];
+    unsigned long pages[FLUSH_REASONS][FLUSH_BUCKETS];
+    unsigned long per_cpu[];                // [FLUSH_REASONS][nr_cpus]
+};
+
+struct flush_trace {
+    char root[64];              // the tracefs mount
+    char dir[128];              // our instance in it
+    const char* source;         // "tracepoint" or "kprobe"
+    char events[2][96];         // enable files, relative to dir
+    int nr_events;
+    long nr_cpus;
+    pid_t reader;
+    unsigned long overrun;      // events lost because the reader fell behind
+    struct flush_counts* counts;
+};
+
+int flush_trace_setup(struct flush_trace* ft, long nr_cpus, long buffer_kb);
+int flush_trace_start(struct flush_trace* ft, long cpu);
+void flush_trace_stop(struct flush_trace* ft);
+void flush_trace_print(const struct flush_trace* ft);
+void flush_trace_write(FILE* f, const struct flush_trace* ft);
+void flush_trace_teardown(struct flush_trace* ft);
+
+// see noise.c
+struct noise_cpu {
+    long floor_ns;              // the quickest pass of the calibration loop
+    long max_gap_ns;            // the longest interruption
+    long interruptions;
+    double noise_pct;           // how much of the calibration window the interruptions took
+    long irqs;                  // irqs currently aimed at this cpu
+    bool isolated;
+    bool nohz_full;
+    bool flagged;               // noise_pct over threshold_pct
+};
+
+struct noise {
+    long calibration_ms;        // per cpu
+    double threshold_pct;       // -J
+    int fifo_priority;          // -R, 0 leaves workers SCHED_OTHER
+    bool locked;                // mlockall() worked
+    char isolated[256];         // cpu lists, as the kernel prints them
+    char nohz_full[256];
+    pid_t irqbalance;           // 0 when it isn't running
+    char irqbalance_banned[256];
+    long nr_cpus;
+    struct noise_cpu* cpus;
+};
+
+int noise_setup(struct noise* n, long nr_cpus);
+void* noise_stack(struct noise* n, pthread_attr_t* attr);
+void noise_free_stack(void* stack);
+void noise_fifo_attr(const struct noise* n, pthread_attr_t* attr);
+void noise_fifo_self(const struct noise* n, bool on);
+void noise_jittery(const struct noise* n, const cpu_set_t* cpus, char* buf, size_t size);
+void noise_write(FILE* f, const struct noise* n, const char* jittery);
+void noise_free(struct noise* n);
+
+extern const struct workload workload_mmap_private;
+extern const struct workload workload_mmap_membacked;
+extern const struct workload workload_mmap_memfd;
+extern const struct workload workload_mmap_shmem;
+extern const struct workload workload_mmap_filebacked;
+extern const struct workload workload_mprotect_shootdown;
+extern const struct workload workload_mprotect_noprotchange;
+extern const struct workload workload_scan_mmap;
+extern const struct workload workload_scan_mmap_populate;
+extern const struct workload workload_scan_mmap_sequential;
+extern const struct workload workload_scan_pread;
+extern const struct workload workload_scan_uring;
+
+#endif
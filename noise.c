@@ -0,0 +1,309 @@
+/* noise.c - -N, running with as little noise as we can, and measuring what's left
+ *
+ * the harness is mlockall()ed before the workload sets anything up, so only the workload's own
+ * mappings ever fault, and worker threads get mlocked stacks. with -R prio the workers run
+ * SCHED_FIFO, so nothing SCHED_OTHER preempts them (RT throttling still leaves the kernel its 5%).
+ * we also say which cpus are isolcpus or nohz_full, whether irqbalance is running and which cpus it
+ * was told to leave alone, and how many irqs are currently aimed at each cpu.
+ *
+ * before benchmarking, each cpu in turn runs a calibration loop that only reads the clock (vDSO, no
+ * syscalls) for calibration_ms. every gap between two reads longer than NOISE_GAP_NS is something
+ * else taking the cpu away: a tick, an irq, a kworker. the share of the window lost to those is
+ * the cpu's noise, and a cpu whose noise is over -J percent gets flagged, along with every run
+ * that puts a worker on it.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "microbenchmark.h"
+
+#define NOISE_GAP_NS 1000
+#define NOISE_STACK_SIZE (1024 * 1024)
+
+static long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static void read_line(const char* path, char* buf, size_t size) {
+    buf[0] = '\0';
+    FILE* f = fopen(path, "r");
+    if (!f) return;
+    if (fgets(buf, size, f)) {
+        buf[strcspn(buf, "\n")] = '\0';
+    }
+    fclose(f);
+}
+
+// "0-3,8,10-11" -> cpus[0..3], cpus[8], cpus[10..11] set
+static void parse_cpulist(const char* list, bool* cpus, long nr_cpus) {
+    const char* p = list;
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p) break;
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+        for (long c = first; c <= last && c < nr_cpus; c++) {
+            if (c >= 0) cpus[c] = true;
+        }
+        if (*end != ',') break;
+        p = end + 1;
+    }
+}
+
+// irqbalance's pid, and the cpus it was told to keep irqs off, if it's running
+static void find_irqbalance(struct noise* n) {
+    DIR* proc = opendir("/proc");
+    struct dirent* entry;
+    char path[PATH_MAX];
+    char comm[64];
+
+    n->irqbalance = 0;
+    n->irqbalance_banned[0] = '\0';
+    if (!proc) return;
+    while ((entry = readdir(proc))) {
+        if (!isdigit(entry->d_name[0])) continue;
+        snprintf(path, sizeof(path), "/proc/%s/comm", entry->d_name);
+        read_line(path, comm, sizeof(comm));
+        if (strcmp(comm, "irqbalance")) continue;
+        n->irqbalance = atol(entry->d_name);
+
+        // IRQBALANCE_BANNED_CPULIST, or the older hex mask IRQBALANCE_BANNED_CPUS, from its environment
+        char environ[16384];
+        snprintf(path, sizeof(path), "/proc/%s/environ", entry->d_name);
+        FILE* f = fopen(path, "r");
+        if (!f) break;
+        size_t len = fread(environ, 1, sizeof(environ) - 1, f);
+        fclose(f);
+        environ[len] = '\0';
+        for (char* var = environ; var < environ + len; var += strlen(var) + 1) {
+            if (!strncmp(var, "IRQBALANCE_BANNED_CPU", 21)) {
+                snprintf(n->irqbalance_banned, sizeof(n->irqbalance_banned), "%.*s", (int)sizeof(n->irqbalance_banned) - 1, var);
+            }
+        }
+        break;
+    }
+    closedir(proc);
+}
+
+// how many irqs each cpu would take right now
+static void count_irqs(struct noise* n) {
+    DIR* irq = opendir("/proc/irq");
+    struct dirent* entry;
+    char path[PATH_MAX];
+    char list[1024];
+    bool* cpus = calloc(n->nr_cpus, sizeof(bool));
+
+    if (!irq || !cpus) {
+        if (irq) closedir(irq);
+        free(cpus);
+        return;
+    }
+    while ((entry = readdir(irq))) {
+        if (!isdigit(entry->d_name[0])) continue;
+        snprintf(path, sizeof(path), "/proc/irq/%s/effective_affinity_list", entry->d_name);
+        read_line(path, list, sizeof(list));
+        if (!list[0]) {
+            snprintf(path, sizeof(path), "/proc/irq/%s/smp_affinity_list", entry->d_name);
+            read_line(path, list, sizeof(list));
+        }
+        memset(cpus, 0, n->nr_cpus * sizeof(bool));
+        parse_cpulist(list, cpus, n->nr_cpus);
+        for (long c = 0; c < n->nr_cpus; c++) {
+            if (cpus[c]) n->cpus[c].irqs++;
+        }
+    }
+    closedir(irq);
+    free(cpus);
+}
+
+static void calibrate(struct noise_cpu* c, long window_ns) {
+    long first = now_ns();
+    long prev = first;
+    long lost = 0;
+
+    c->floor_ns = LONG_MAX;
+    while (prev - first < window_ns) {
+        long t = now_ns();
+        long gap = t - prev;
+        if (gap < c->floor_ns) c->floor_ns = gap;
+        if (gap > NOISE_GAP_NS) {
+            lost += gap;
+            c->interruptions++;
+            if (gap > c->max_gap_ns) c->max_gap_ns = gap;
+        }
+        prev = t;
+    }
+    c->noise_pct = 100.0 * lost / (prev - first);
+}
+
+int noise_setup(struct noise* n, long nr_cpus) {
+    n->nr_cpus = nr_cpus;
+    n->cpus = calloc(nr_cpus, sizeof(struct noise_cpu));
+    if (!n->cpus) {
+        perror("noise state allocation failed");
+        return -1;
+    }
+
+    // everything the harness has so far, before the workload maps anything
+    n->locked = mlockall(MCL_CURRENT) == 0;
+    if (!n->locked) {
+        printf("mlockall() failed: %s, the harness can still fault (raise RLIMIT_MEMLOCK or run as root)\n", strerror(errno));
+    }
+
+    if (n->fifo_priority) {
+        struct sched_param param = { .sched_priority = n->fifo_priority };
+        if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+            printf("can't use SCHED_FIFO priority %d: %s, workers stay SCHED_OTHER\n", n->fifo_priority, strerror(errno));
+            n->fifo_priority = 0;
+        }
+    }
+
+    bool* set = calloc(nr_cpus, sizeof(bool));
+    if (!set) {
+        perror("noise state allocation failed");
+        return -1;
+    }
+    read_line("/sys/devices/system/cpu/isolated", n->isolated, sizeof(n->isolated));
+    read_line("/sys/devices/system/cpu/nohz_full", n->nohz_full, sizeof(n->nohz_full));
+    parse_cpulist(n->isolated, set, nr_cpus);
+    for (long c = 0; c < nr_cpus; c++) {
+        n->cpus[c].isolated = set[c];
+        set[c] = false;
+    }
+    parse_cpulist(n->nohz_full, set, nr_cpus);
+    for (long c = 0; c < nr_cpus; c++) {
+        n->cpus[c].nohz_full = set[c];
+    }
+    free(set);
+    find_irqbalance(n);
+    count_irqs(n);
+
+    printf("low noise: mlockall %s, workers %s, isolcpus \"%s\", nohz_full \"%s\"\n",
+        n->locked ? "on" : "FAILED", n->fifo_priority ? "SCHED_FIFO" : "SCHED_OTHER", n->isolated, n->nohz_full);
+    if (n->irqbalance) {
+        printf("irqbalance is running (pid %d)%s%s\n", n->irqbalance, n->irqbalance_banned[0] ? ", " : ", and may move irqs onto any cpu", n->irqbalance_banned);
+    } else {
+        printf("irqbalance isn't running\n");
+    }
+
+    // calibrate every cpu, as the workers would run there
+    cpu_set_t old, cpuset;
+    sched_getaffinity(0, sizeof(cpu_set_t), &old);
+    printf("calibrating %ld cpus for %ld ms each, flagging noise over %.2f%%\n", nr_cpus, n->calibration_ms, n->threshold_pct);
+    printf("%5s %9s %9s %13s %13s %6s\n", "cpu", "floor ns", "noise %", "max gap ns", "interruptions", "irqs");
+    for (long c = 0; c < nr_cpus; c++) {
+        CPU_ZERO(&cpuset);
+        CPU_SET(c, &cpuset);
+        if (sched_setaffinity(0, sizeof(cpu_set_t), &cpuset)) {
+            printf("can't move to cpu %ld to calibrate it: %s\n", c, strerror(errno));
+            continue;
+        }
+        calibrate(&n->cpus[c], n->calibration_ms * 1000000L);
+        n->cpus[c].flagged = n->cpus[c].noise_pct > n->threshold_pct;
+        printf("%5ld %9ld %9.3f %13ld %13ld %6ld%s%s%s\n", c, n->cpus[c].floor_ns, n->cpus[c].noise_pct, n->cpus[c].max_gap_ns,
+            n->cpus[c].interruptions, n->cpus[c].irqs, n->cpus[c].isolated ? " isolated" : "", n->cpus[c].nohz_full ? " nohz_full" : "",
+            n->cpus[c].flagged ? " JITTERY" : "");
+    }
+    sched_setaffinity(0, sizeof(cpu_set_t), &old);
+
+    // only the workers run SCHED_FIFO, the harness goes back to normal
+    if (n->fifo_priority) {
+        struct sched_param param = { .sched_priority = 0 };
+        sched_setscheduler(0, SCHED_OTHER, &param);
+    }
+    printf("\n");
+    return 0;
+}
+
+// a worker thread's stack, mlocked, since mlockall() only covered what existed then. if that doesn't
+// work out the thread gets an ordinary stack, and the run isn't recorded as locked
+void* noise_stack(struct noise* n, pthread_attr_t* attr) {
+    void* stack = mmap(NULL, NOISE_STACK_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        printf("uhoh, couldn't map a worker stack: %s, it gets an unlocked one\n", strerror(errno));
+        n->locked = false;
+        return NULL;
+    }
+    if (mlock(stack, NOISE_STACK_SIZE)) {
+        printf("uhoh, couldn't mlock a worker stack: %s\n", strerror(errno));
+        n->locked = false;
+    }
+    int ret = pthread_attr_setstack(attr, stack, NOISE_STACK_SIZE);
+    if (ret) {
+        printf("uhoh, couldn't give a worker its stack: %s, it gets an unlocked one\n", strerror(ret));
+        n->locked = false;
+        munmap(stack, NOISE_STACK_SIZE);
+        return NULL;
+    }
+    return stack;
+}
+
+void noise_free_stack(void* stack) {
+    if (stack) munmap(stack, NOISE_STACK_SIZE);
+}
+
+void noise_fifo_attr(const struct noise* n, pthread_attr_t* attr) {
+    if (!n->fifo_priority) return;
+    struct sched_param param = { .sched_priority = n->fifo_priority };
+    pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+    pthread_attr_setschedparam(attr, &param);
+}
+
+// for the workers that are the main thread, or a forked process
+void noise_fifo_self(const struct noise* n, bool on) {
+    if (!n->fifo_priority) return;
+    struct sched_param param = { .sched_priority = on ? n->fifo_priority : 0 };
+    pthread_setschedparam(pthread_self(), on ? SCHED_FIFO : SCHED_OTHER, &param);
+}
+
+// the flagged cpus among cpus, as "3,5", or "" if none
+void noise_jittery(const struct noise* n, const cpu_set_t* cpus, char* buf, size_t size) {
+    size_t len = 0;
+    buf[0] = '\0';
+    for (long c = 0; c < n->nr_cpus && len < size; c++) {
+        if (n->cpus[c].flagged && CPU_ISSET(c, cpus)) {
+            len += snprintf(buf + len, size - len, "%s%ld", len ? "," : "", c);
+        }
+    }
+}
+
+void noise_write(FILE* f, const struct noise* n, const char* jittery) {
+    fprintf(f, "\"noise\": {\"mlockall\": %s, \"sched_fifo\": %d, \"calibration_ms\": %ld, \"threshold_pct\": %.3f, \"isolated\": ",
+        n->locked ? "true" : "false", n->fifo_priority, n->calibration_ms, n->threshold_pct);
+    json_string(f, n->isolated);
+    fprintf(f, ", \"nohz_full\": ");
+    json_string(f, n->nohz_full);
+    fprintf(f, ", \"irqbalance\": {\"pid\": %d, \"banned\": ", n->irqbalance);
+    json_string(f, n->irqbalance_banned);
+    fprintf(f, "}, \"jittery_cpus\": ");
+    json_string(f, jittery);
+    fprintf(f, ", \"per_cpu\": [");
+    for (long c = 0; c < n->nr_cpus; c++) {
+        const struct noise_cpu* cpu = &n->cpus[c];
+        fprintf(f, "%s{\"cpu\": %ld, \"floor_ns\": %ld, \"noise_pct\": %.4f, \"max_gap_ns\": %ld, \"interruptions\": %ld, \"irqs\": %ld, \"isolated\": %s, \"nohz_full\": %s, \"flagged\": %s}",
+            c ? ", " : "", c, cpu->floor_ns, cpu->noise_pct, cpu->max_gap_ns, cpu->interruptions, cpu->irqs,
+            cpu->isolated ? "true" : "false", cpu->nohz_full ? "true" : "false", cpu->flagged ? "true" : "false");
+    }
+    fprintf(f, "]}");
+}
+
+void noise_free(struct noise* n) {
+    free(n->cpus);
+}
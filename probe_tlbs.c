@@ -4,16 +4,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <unistd.h>
 
 #define PAGE_SIZE 4096
-#define NUM_THREADS 64
-#define NUM_BARRIERS NUM_THREADS + 1
 #define PAGES_PER_THREAD 5
 #define MADV_PROBE_TLB 28
 
-pthread_t threads[NUM_THREADS];
-pthread_barrier_t barriers[NUM_BARRIERS];
-char* ptrs[NUM_THREADS];
+// one thread per online cpu, and one barrier per thread plus a final one
+long num_threads;
+pthread_t* threads;
+pthread_barrier_t* barriers;
+char** ptrs;
 
 void* probe_tlb_test(void* tid) {
     unsigned long cpu = (unsigned long) tid;
@@ -43,34 +44,44 @@ void* probe_tlb_test(void* tid) {
     *(ptrs[cpu]) = 'x'; // touch page to fault-in and load TLB
 
     // check TLB for everyone's threads
-    for (long i=0; i<NUM_THREADS; i++) {
+    for (long i=0; i<num_threads; i++) {
         pthread_barrier_wait(&barriers[i]);
 
         // each thread/core probes TLB for core N's page and reports if they found it
         result = madvise(ptrs[i], PAGE_SIZE, MADV_PROBE_TLB);
         if (!result) { // TLB hit
-            printf("cpu %2ld found cpu %2ld's page with vpn %p and returned %d\n", cpu, i, (unsigned long) ptrs[cpu] >> 12, result);
+            printf("cpu %2ld found cpu %2ld's page with vpn %p and returned %d\n", cpu, i, (void*) ((unsigned long) ptrs[cpu] >> 12), result);
         } else {
 	    // TLB miss
             // printf("cpu %2ld probed %p and returned %d\n", cpu, (unsigned long) ptrs[cpu] >> 12, result);
         }
     }
-    pthread_barrier_wait(&barriers[NUM_THREADS]);
+    pthread_barrier_wait(&barriers[num_threads]);
+    return NULL;
 }
 
 int main(void) {
     int result;
 
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = calloc(num_threads, sizeof(pthread_t));
+    barriers = calloc(num_threads + 1, sizeof(pthread_barrier_t));
+    ptrs = calloc(num_threads, sizeof(char*));
+    if (!threads || !barriers || !ptrs) {
+        printf("allocating state for %ld cpus failed\n", num_threads);
+        return 1;
+    }
+
     // initialize barriers
-    for (unsigned long i=0; i<NUM_BARRIERS; i++) {
-        result = pthread_barrier_init(&barriers[i], NULL, NUM_THREADS);
+    for (long i=0; i<num_threads+1; i++) {
+        result = pthread_barrier_init(&barriers[i], NULL, num_threads);
         if (result) {
             printf("pthread_barrier_init() %ld failed with return code, %d\n", i, result);
             return result;
         }
     }
     // create a thread for each core
-    for (unsigned long i=0; i<NUM_THREADS-1; i++) {
+    for (long i=0; i<num_threads-1; i++) {
         result = pthread_create(&threads[i], NULL, probe_tlb_test, (void*) i);
         if (result) {
             printf("ERROR: return code for thread %ld from pthread_create() is %d\n", i, result);
@@ -78,5 +89,5 @@ int main(void) {
         }
     }
 
-    probe_tlb_test( (void*) NUM_THREADS-1 );
+    probe_tlb_test( (void*) (num_threads-1) );
 }
@@ -0,0 +1,231 @@
+/* record.c - describe the machine and kernel a run happened on, as JSON
+ *
+ * everything here is gathered once, before benchmarking, and written into every result record
+ * so runs can be joined across machines and kernels without encoding anything in filenames.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "microbenchmark.h"
+
+#define MADV_PROBE_TLB 28
+#define NT_GNU_BUILD_ID 3
+
+void json_string(FILE* f, const char* s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(f, "\\%c", *s);
+        } else if ((unsigned char) *s < 0x20) {
+            fprintf(f, "\\u%04x", *s);
+        } else {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+// read the first line of a file into buf, without its newline, or leave buf empty
+static void read_line(const char* path, char* buf, size_t size) {
+    buf[0] = '\0';
+    FILE* f = fopen(path, "r");
+    if (!f) return;
+    if (fgets(buf, size, f)) {
+        buf[strcspn(buf, "\n")] = '\0';
+    }
+    fclose(f);
+}
+
+// "always [madvise] never" -> "madvise"
+static void read_bracketed(const char* path, char* buf, size_t size) {
+    char line[256];
+    read_line(path, line, sizeof(line));
+    char* open = strchr(line, '[');
+    char* close = open ? strchr(open, ']') : NULL;
+    if (open && close) {
+        snprintf(buf, size, "%.*s", (int) (close - open - 1), open + 1);
+    } else {
+        read_line(path, buf, size);
+    }
+}
+
+// the running kernel's GNU build ID, from the ELF notes the kernel exports in /sys/kernel/notes
+static void read_build_id(char* buf, size_t size) {
+    unsigned char notes[4096];
+    buf[0] = '\0';
+
+    FILE* f = fopen("/sys/kernel/notes", "r");
+    if (!f) return;
+    size_t len = fread(notes, 1, sizeof(notes), f);
+    fclose(f);
+
+    for (size_t off = 0; off + 12 <= len; ) {
+        uint32_t namesz, descsz, type;
+        memcpy(&namesz, notes + off, 4);
+        memcpy(&descsz, notes + off + 4, 4);
+        memcpy(&type, notes + off + 8, 4);
+        size_t name_off = off + 12;
+        size_t desc_off = name_off + ((namesz + 3) & ~3u);
+        size_t next = desc_off + ((descsz + 3) & ~3u);
+        if (next > len) break;
+
+        if (type == NT_GNU_BUILD_ID && namesz == 4 && !memcmp(notes + name_off, "GNU", 4)) {
+            for (uint32_t i = 0; i < descsz && 2*i + 2 < size; i++) {
+                snprintf(buf + 2*i, 3, "%02x", notes[desc_off + i]);
+            }
+            return;
+        }
+        off = next;
+    }
+}
+
+// what this kernel accepts of the smokewagon interface
+static void probe_smokewagon(struct system_info* info) {
+    // MAP_SHARED_VALIDATE rejects flags the kernel doesn't know, instead of ignoring them
+    char* ptr = mmap(NULL, PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED_VALIDATE|MAP_ANONYMOUS|MAP_PRIVATE_TLB, -1, 0);
+    info->map_private_tlb = ptr != MAP_FAILED;
+    if (ptr != MAP_FAILED) munmap(ptr, PAGE_SIZE);
+
+    ptr = mmap(NULL, PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) return;
+    ptr[0] = 'x';
+    info->madv_private_tlb = madvise(ptr, PAGE_SIZE, MADV_PRIVATE_TLB) == 0;
+    info->madv_probe_tlb = madvise(ptr, PAGE_SIZE, MADV_PROBE_TLB) == 0 || errno != EINVAL;
+    info->madv_normal_tlb = madvise(ptr, PAGE_SIZE, MADV_NORMAL_TLB) == 0;
+    munmap(ptr, PAGE_SIZE);
+}
+
+static void probe_topology(struct system_info* info) {
+    char path[128];
+    char line[64];
+    long packages[64];
+    int nr_packages = 0;
+
+    info->cores = 0;
+    info->packages = 0;
+    for (long cpu = 0; cpu < info->online_cpus; cpu++) {
+        // a cpu is the first thread of its core when it's the first in its thread_siblings_list
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/topology/thread_siblings_list", cpu);
+        read_line(path, line, sizeof(line));
+        if (line[0] && atol(line) == cpu) info->cores++;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/topology/physical_package_id", cpu);
+        read_line(path, line, sizeof(line));
+        if (!line[0]) continue;
+        long package = atol(line);
+        bool seen = false;
+        for (int i = 0; i < nr_packages; i++) {
+            if (packages[i] == package) seen = true;
+        }
+        if (!seen && nr_packages < 64) packages[nr_packages++] = package;
+    }
+    info->packages = nr_packages;
+}
+
+void probe_system(struct system_info* info, const char* kernel_hash) {
+    struct utsname u;
+
+    memset(info, 0, sizeof(*info));
+    if (uname(&u) == 0) {
+        snprintf(info->hostname, sizeof(info->hostname), "%s", u.nodename);
+        snprintf(info->release, sizeof(info->release), "%s", u.release);
+        snprintf(info->machine, sizeof(info->machine), "%s", u.machine);
+    }
+    read_line("/proc/version", info->proc_version, sizeof(info->proc_version));
+    read_build_id(info->build_id, sizeof(info->build_id));
+
+    // kernel hash: -k if given, else the -g<hash> CONFIG_LOCALVERSION_AUTO puts in the release, else the build ID
+    const char* g = strstr(info->release, "-g");
+    if (kernel_hash && kernel_hash[0]) {
+        snprintf(info->kernel_hash, sizeof(info->kernel_hash), "%s", kernel_hash);
+    } else if (g && strspn(g + 2, "0123456789abcdef") >= 7) {
+        snprintf(info->kernel_hash, sizeof(info->kernel_hash), "%.*s", (int) strspn(g + 2, "0123456789abcdef"), g + 2);
+    } else {
+        snprintf(info->kernel_hash, sizeof(info->kernel_hash), "%s", info->build_id[0] ? info->build_id : info->release);
+    }
+
+    // x86 says "model name", riscv says "uarch" (and "isa"), arm64 only has "CPU part"
+    FILE* f = fopen("/proc/cpuinfo", "r");
+    if (f) {
+        char line[1024];
+        while (fgets(line, sizeof(line), f) && !info->cpu_model[0]) {
+            if (!strncmp(line, "model name", 10) || !strncmp(line, "uarch", 5) || !strncmp(line, "CPU part", 8)) {
+                char* colon = strchr(line, ':');
+                if (!colon) continue;
+                colon += strspn(colon + 1, " \t") + 1;
+                colon[strcspn(colon, "\n")] = '\0';
+                snprintf(info->cpu_model, sizeof(info->cpu_model), "%s", colon);
+            }
+        }
+        fclose(f);
+    }
+
+    info->online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    read_line("/sys/devices/system/cpu/online", info->online_list, sizeof(info->online_list));
+    read_line("/sys/devices/system/node/online", info->numa_nodes, sizeof(info->numa_nodes));
+    probe_topology(info);
+
+    read_bracketed("/sys/kernel/mm/transparent_hugepage/enabled", info->thp_enabled, sizeof(info->thp_enabled));
+    read_bracketed("/sys/kernel/mm/transparent_hugepage/defrag", info->thp_defrag, sizeof(info->thp_defrag));
+
+    probe_smokewagon(info);
+}
+
+// statfs() f_type, for the filesystems anyone's likely to put a benchmark file on
+const char* fs_type_name(unsigned long magic) {
+    switch (magic) {
+        case 0xef53:        return "ext4";  // also ext2 and ext3
+        case 0x58465342:    return "xfs";
+        case 0x9123683e:    return "btrfs";
+        case 0xf2f52010:    return "f2fs";
+        case 0x2fc12fc1:    return "zfs";
+        case 0x01021994:    return "tmpfs"; // also memfd and shmem
+        case 0x958458f6:    return "hugetlbfs";
+        case 0x794c7630:    return "overlayfs";
+        case 0x6969:        return "nfs";
+        case 0xff534d42:    return "cifs";
+        case 0x65735546:    return "fuse";
+        case 0x01021997:    return "9p";
+        case 0x858458f6:    return "ramfs";
+        default:            return "unknown";
+    }
+}
+
+void write_system(FILE* f, const struct system_info* info) {
+    fprintf(f, "\"kernel\": {\"release\": ");
+    json_string(f, info->release);
+    fprintf(f, ", \"proc_version\": ");
+    json_string(f, info->proc_version);
+    fprintf(f, ", \"hash\": ");
+    json_string(f, info->kernel_hash);
+    fprintf(f, ", \"build_id\": ");
+    json_string(f, info->build_id);
+    fprintf(f, "}, \"machine\": {\"hostname\": ");
+    json_string(f, info->hostname);
+    fprintf(f, ", \"arch\": ");
+    json_string(f, info->machine);
+    fprintf(f, ", \"cpu_model\": ");
+    json_string(f, info->cpu_model);
+    fprintf(f, ", \"online_cpus\": %ld, \"online_list\": ", info->online_cpus);
+    json_string(f, info->online_list);
+    fprintf(f, ", \"cores\": %ld, \"packages\": %ld, \"numa_nodes\": ", info->cores, info->packages);
+    json_string(f, info->numa_nodes);
+    fprintf(f, "}, \"thp\": {\"enabled\": ");
+    json_string(f, info->thp_enabled);
+    fprintf(f, ", \"defrag\": ");
+    json_string(f, info->thp_defrag);
+    fprintf(f, "}, \"smokewagon_probe\": {\"map_private_tlb\": %s, \"madv_private_tlb\": %s, \"madv_normal_tlb\": %s, \"madv_probe_tlb\": %s}",
+        info->map_private_tlb ? "true" : "false",
+        info->madv_private_tlb ? "true" : "false",
+        info->madv_normal_tlb ? "true" : "false",
+        info->madv_probe_tlb ? "true" : "false");
+}
@@ -0,0 +1,178 @@
+/* sampler.c - record every thread's loop count every few milliseconds while a run is going
+ *
+ * workers publish their running loop counts in their own cache lines (struct live_counter), and a
+ * sampler thread, pinned to a cpu the run isn't using when there is one, copies all of them out
+ * on a fixed schedule. optionally it also reads TLB shootdown and function call IPI totals from
+ * /proc/interrupts, so a dip in throughput can be lined up with a flush storm.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "microbenchmark.h"
+
+// sum a row of /proc/interrupts across all cpus, picked by a substring of its description,
+// e.g. "TLB shootdowns" on x86 or "Function call interrupts" everywhere
+unsigned long read_interrupts(const char* name) {
+    FILE* f = fopen("/proc/interrupts", "r");
+    char line[8192];
+    unsigned long total = 0;
+
+    if (!f) return 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (!strstr(line, name)) continue;
+        char* p = strchr(line, ':');
+        if (!p) continue;
+        p++;
+        // the per-cpu counts come first, then the description
+        while (true) {
+            char* endptr;
+            unsigned long n = strtoul(p, &endptr, 10);
+            if (endptr == p) break;
+            total += n;
+            p = endptr;
+        }
+    }
+    fclose(f);
+    return total;
+}
+
+static long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+// the last slot is kept for the final sample, so the series always ends at the final totals
+static void take_sample(struct sampler* s, bool final) {
+    if (!final && s->nr_samples >= s->max_samples - 1) {
+        s->dropped++;
+        return;
+    }
+
+    long n = s->nr_samples < s->max_samples ? s->nr_samples : s->max_samples - 1;
+    s->t_ns[n] = now_ns() - s->start_ns;
+    for (long i = 0; i < s->nr_threads; i++) {
+        s->loops[n * s->nr_threads + i] = atomic_load_explicit(&s->live[i].loops, memory_order_relaxed);
+    }
+    if (s->ipis) {
+        s->tlb_ipis[n] = read_interrupts("TLB") - s->tlb_base;
+        s->call_ipis[n] = read_interrupts("Function call") - s->call_base;
+    }
+    s->nr_samples = n + 1;
+}
+
+static void* sample(void* sampler_ptr) {
+    struct sampler* s = sampler_ptr;
+    long next = s->start_ns;
+
+    take_sample(s, false);
+    while (!atomic_load(&s->stop)) {
+        next += s->interval_ms * 1000000L;
+        struct timespec wake = { .tv_sec = next / 1000000000L, .tv_nsec = next % 1000000000L };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR);
+        take_sample(s, false);
+    }
+
+    return sampler_ptr;
+}
+
+int sampler_init(struct sampler* s, struct live_counter* live, long max_threads, long duration) {
+    s->live = live;
+    // a sample per interval, plus slack for the last one and for runs that overshoot a little
+    s->max_samples = duration * 1000 / s->interval_ms + 16;
+    s->t_ns = calloc(s->max_samples, sizeof(long));
+    s->loops = calloc(s->max_samples * max_threads, sizeof(unsigned long));
+    s->tlb_ipis = calloc(s->max_samples, sizeof(unsigned long));
+    s->call_ipis = calloc(s->max_samples, sizeof(unsigned long));
+    if (!s->t_ns || !s->loops || !s->tlb_ipis || !s->call_ipis) {
+        return -1;
+    }
+    return 0;
+}
+
+int sampler_start(struct sampler* s, long nr_threads, long cpu) {
+    pthread_attr_t attr;
+    cpu_set_t cpuset;
+
+    s->nr_threads = nr_threads;
+    s->nr_samples = 0;
+    s->dropped = 0;
+    atomic_store(&s->stop, false);
+    if (s->ipis) {
+        s->tlb_base = read_interrupts("TLB");
+        s->call_base = read_interrupts("Function call");
+    }
+    s->start_ns = now_ns();
+
+    pthread_attr_init(&attr);
+    if (cpu >= 0) {
+        CPU_ZERO(&cpuset);
+        CPU_SET(cpu, &cpuset);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
+    }
+    int ret = pthread_create(&s->thread, &attr, sample, s);
+    pthread_attr_destroy(&attr);
+    return ret;
+}
+
+void sampler_stop(struct sampler* s) {
+    atomic_store(&s->stop, true);
+    pthread_join(s->thread, NULL);
+    // and once more now that everyone's done, so the series ends at the final totals
+    take_sample(s, true);
+    if (s->dropped) {
+        printf("uhoh, the run outlasted the sampler's buffer, %ld samples before the final one were dropped\n", s->dropped);
+    }
+}
+
+// the slowest and fastest interval, in loops per second across all threads. intervals ending
+// after the run's deadline (end_ns, CLOCK_MONOTONIC) don't count, since workers are finishing up
+// or already gone by then, and neither do intervals under half the period
+void sampler_summary(const struct sampler* s, long end_ns, double* min_rate, double* max_rate) {
+    bool first = true;
+
+    *min_rate = 0;
+    *max_rate = 0;
+    for (long n = 1; n < s->nr_samples; n++) {
+        if (s->start_ns + s->t_ns[n] > end_ns) break;
+        if (s->t_ns[n] - s->t_ns[n-1] < s->interval_ms * 500000L) continue;
+
+        unsigned long delta = 0;
+        for (long i = 0; i < s->nr_threads; i++) {
+            delta += s->loops[n * s->nr_threads + i] - s->loops[(n-1) * s->nr_threads + i];
+        }
+        double rate = delta * 1e9 / (s->t_ns[n] - s->t_ns[n-1]);
+        if (first || rate < *min_rate) *min_rate = rate;
+        if (first || rate > *max_rate) *max_rate = rate;
+        first = false;
+    }
+}
+
+void sampler_write(FILE* f, const struct sampler* s) {
+    fprintf(f, "\"interval_ms\": %ld, \"samples\": [", s->interval_ms);
+    for (long n = 0; n < s->nr_samples; n++) {
+        fprintf(f, "%s{\"t_ms\": %.3f, \"loops\": [", n ? ", " : "", s->t_ns[n] / 1e6);
+        for (long i = 0; i < s->nr_threads; i++) {
+            fprintf(f, "%s%lu", i ? ", " : "", s->loops[n * s->nr_threads + i]);
+        }
+        fprintf(f, "]");
+        if (s->ipis) {
+            fprintf(f, ", \"tlb_ipis\": %lu, \"call_ipis\": %lu", s->tlb_ipis[n], s->call_ipis[n]);
+        }
+        fprintf(f, "}");
+    }
+    fprintf(f, "]");
+}
+
+void sampler_free(struct sampler* s) {
+    free(s->t_ns);
+    free(s->loops);
+    free(s->tlb_ipis);
+    free(s->call_ipis);
+}
@@ -0,0 +1,265 @@
+#!/usr/bin/env python3
+"""sweep.py - run the microbenchmark driver over a whole parameter matrix, resumably
+
+usage: ./sweep.py sweep-mmap.json [-n]
+
+the config file lists values for every axis (workloads, smokewagon, threads, pages, placement,
+threads_per_cpu, workers) plus a duration and a number of repetitions, and every combination of them times
+every repetition is a cell. each cell is one driver run with exactly that many threads. cells run in
+a random order, seeded from the config, so slow drift (thermals, page cache, fragmentation) spreads
+over every configuration instead of piling up on whichever came last.
+
+every finished cell appends its driver record to result-sweep-<name>.jsonl and one row to
+result-sweep-<name>.csv, the long-format dataset the notebook plots. both are flushed after every
+cell, and rerunning the same config on the same kernel skips every cell already in the csv, so an
+interrupted sweep picks up where it stopped. -n only prints what would run.
+
+"low_noise": true runs every cell in the driver's low-noise mode (-N), with "sched_fifo" and
+"jitter_pct" passed on as -R and -J. cells that ran on a cpu calibration flagged as noisy list it
+in the jittery_cpus column, so they can be dropped or rerun.
+
+only the standard library, so it runs on the bench boards as is.
+"""
+
+import argparse
+import csv
+import itertools
+import json
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+COLUMNS = [
+    "sweep", "kernel_hash", "kernel_release", "proc_version", "hostname", "cpu_model",
+    "workload", "family", "variant", "smokewagon", "threads", "threads_per_cpu", "placement",
+    "pages", "workers", "backing_fs", "file_mib", "duration_s", "rep", "order", "timestamp", "loops", "loops_per_sec", "errors",
+    "jittery_cpus",
+]
+
+# what identifies a cell, together with the kernel it ran on
+KEY = ["workload", "smokewagon", "threads", "threads_per_cpu", "placement", "pages", "workers", "file_mib", "duration_s", "rep"]
+
+DRIVER_FILE_MIB = 1024          # the driver's -z when file_mib isn't set
+
+DEFAULTS = {
+    "driver": "./microbenchmark",
+    "workdir": None,            # where the driver runs and leaves its files, default .sweep-<name>
+    "kernel_hash": None,        # passed on as -k
+    "file_dir": None,           # passed on as -D, where file-backed workloads put their files
+    "file_mib": None,           # passed on as -z, how big a file the scan workloads scan
+    "duration": 5,
+    "repetitions": 1,
+    "seed": 0,
+    "workloads": ["mmap-membacked"],
+    "smokewagon": [False, True],
+    "threads": [1],
+    "pages": [1],
+    "placement": ["pinned"],
+    "threads_per_cpu": [1],
+    "workers": ["threads"],     # and/or "processes", the no-shootdown ceiling
+    "low_noise": False,         # passed on as -N
+    "sched_fifo": None,         # passed on as -R, a SCHED_FIFO priority for the workers
+    "jitter_pct": None,         # passed on as -J, how noisy a cpu can be before it's flagged
+    "extra_args": [],
+}
+
+
+def expand_threads(values):
+    """[1, 2, "4-16:4", "32-64"] -> [1, 2, 4, 8, 12, 16, 32, 33, ..., 64]"""
+    threads = []
+    for v in values:
+        if isinstance(v, int):
+            threads.append(v)
+            continue
+        span, _, step = str(v).partition(":")
+        first, _, last = span.partition("-")
+        threads.extend(range(int(first), int(last or first) + 1, int(step or 1)))
+    return sorted(set(threads))
+
+
+def load_config(path):
+    with open(path) as f:
+        config = json.load(f)
+    unknown = set(config) - set(DEFAULTS) - {"name"}
+    if unknown:
+        sys.exit(f"{path}: unknown keys {', '.join(sorted(unknown))}")
+    config = {**DEFAULTS, **config}
+    config.setdefault("name", os.path.splitext(os.path.basename(path))[0])
+    config["threads"] = expand_threads(config["threads"])
+    for placement in config["placement"]:
+        if placement not in ("pinned", "floating"):
+            sys.exit(f"{path}: placement is pinned or floating, not {placement}")
+    for workers in config["workers"]:
+        if workers not in ("threads", "processes"):
+            sys.exit(f"{path}: workers are threads or processes, not {workers}")
+    return config
+
+
+def plan(config):
+    cpus = os.cpu_count()
+    cells = []
+    skipped = 0
+    for workload, smokewagon, threads, per_cpu, placement, pages, workers, rep in itertools.product(
+            config["workloads"], config["smokewagon"], config["threads"], config["threads_per_cpu"],
+            config["placement"], config["pages"], config["workers"], range(config["repetitions"])):
+        if -(-threads // per_cpu) > cpus:
+            skipped += 1
+            continue
+        cells.append({
+            "workload": workload, "smokewagon": bool(smokewagon), "threads": threads,
+            "threads_per_cpu": per_cpu, "placement": placement, "pages": pages, "workers": workers,
+            "file_mib": config["file_mib"] or DRIVER_FILE_MIB, "duration_s": config["duration"], "rep": rep,
+        })
+    if skipped:
+        print(f"skipping {skipped} cells that need more than the {cpus} online cpus")
+    return cells
+
+
+def key(row):
+    return tuple(str(row[k]).lower() for k in KEY)
+
+
+def completed(csv_path, proc_version):
+    """keys of cells already in the dataset from this kernel"""
+    done = set()
+    if not os.path.exists(csv_path):
+        return done
+    with open(csv_path, newline="") as f:
+        reader = csv.DictReader(f)
+        if reader.fieldnames != COLUMNS:
+            sys.exit(f"{csv_path} has different columns than this sweep.py writes, move it aside to start a new one")
+        for row in reader:
+            if row["proc_version"] == proc_version:
+                done.add(key(row))
+    return done
+
+
+def command(config, cell):
+    args = [config["driver"], "-w", cell["workload"], "-m", str(cell["threads"]), "-t", str(cell["threads"]),
+            "-d", str(cell["duration_s"]), "-o", str(cell["threads_per_cpu"]), "-p", str(cell["pages"])]
+    if cell["smokewagon"]:
+        args.append("-s")
+    if cell["placement"] == "floating":
+        args.append("-F")
+    if cell["workers"] == "processes":
+        args.append("-P")
+    if config["kernel_hash"]:
+        args += ["-k", config["kernel_hash"]]
+    if config["file_dir"]:
+        args += ["-D", os.path.abspath(config["file_dir"])]
+    if config["file_mib"]:
+        args += ["-z", str(config["file_mib"])]
+    if config["low_noise"]:
+        args.append("-N")
+        if config["sched_fifo"]:
+            args += ["-R", str(config["sched_fifo"])]
+        if config["jitter_pct"]:
+            args += ["-J", str(config["jitter_pct"])]
+    return args + [str(a) for a in config["extra_args"]]
+
+
+def row_from(config, cell, order, record):
+    family, _, variant = record["workload"].partition("-")
+    return {
+        "sweep": config["name"],
+        "kernel_hash": record["kernel"]["hash"],
+        "kernel_release": record["kernel"]["release"],
+        "proc_version": record["kernel"]["proc_version"],
+        "hostname": record["machine"]["hostname"],
+        "cpu_model": record["machine"]["cpu_model"],
+        "workload": record["workload"],
+        "family": family,
+        "variant": variant,
+        "smokewagon": cell["smokewagon"],
+        "threads": cell["threads"],
+        "threads_per_cpu": cell["threads_per_cpu"],
+        "placement": cell["placement"],
+        "pages": cell["pages"],
+        "workers": cell["workers"],
+        "backing_fs": record.get("backing", {}).get("fs", ""),
+        "file_mib": record["config"].get("file_mib", cell["file_mib"]),
+        "duration_s": cell["duration_s"],
+        "rep": cell["rep"],
+        "order": order,
+        "timestamp": record["timestamp"],
+        "loops": record["loops"],
+        "loops_per_sec": record["loops"] / cell["duration_s"],
+        "errors": record["errors"],
+        "jittery_cpus": record.get("noise", {}).get("jittery_cpus", ""),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("config")
+    parser.add_argument("-n", "--dry-run", action="store_true", help="print the cells left to run and stop")
+    opts = parser.parse_args()
+
+    config = load_config(opts.config)
+    config["driver"] = os.path.abspath(config["driver"])
+    workdir = os.path.abspath(config["workdir"] or f".sweep-{config['name']}")
+    csv_path = os.path.abspath(f"result-sweep-{config['name']}.csv")
+    jsonl_path = os.path.abspath(f"result-sweep-{config['name']}.jsonl")
+
+    with open("/proc/version") as f:
+        proc_version = f.readline().rstrip("\n")
+
+    cells = plan(config)
+    done = completed(csv_path, proc_version)
+    todo = [c for c in cells if key(c) not in done]
+    random.Random(config["seed"]).shuffle(todo)
+    print(f"{config['name']}: {len(cells)} cells, {len(cells) - len(todo)} already done on this kernel, {len(todo)} to go")
+    print(f"about {len(todo) * config['duration'] / 60:.0f} minutes of measuring")
+
+    if opts.dry_run:
+        for cell in todo:
+            print(" ".join(command(config, cell)))
+        return 0
+
+    if not os.access(config["driver"], os.X_OK):
+        sys.exit(f"no driver at {config['driver']}, build it or set \"driver\" in {opts.config}")
+    os.makedirs(workdir, exist_ok=True)
+
+    new_csv = not os.path.exists(csv_path)
+    failures = 0
+    with open(csv_path, "a", newline="") as csv_file, open(jsonl_path, "a") as jsonl_file:
+        writer = csv.DictWriter(csv_file, fieldnames=COLUMNS)
+        if new_csv:
+            writer.writeheader()
+
+        for order, cell in enumerate(todo, len(cells) - len(todo)):
+            with tempfile.NamedTemporaryFile("r", dir=workdir, suffix=".jsonl") as record_file:
+                args = command(config, cell)
+                print(f"[{order + 1}/{len(cells)}] {' '.join(args[1:])}", flush=True)
+                result = subprocess.run(args + ["-j", record_file.name], cwd=workdir, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+                lines = record_file.read().splitlines()
+
+            # the driver exits nonzero on verification errors too, but still writes the record
+            if not lines:
+                failures += 1
+                print(f"uhoh, no record from that run (exit {result.returncode}), it'll be retried next time:")
+                print(result.stdout[-2000:])
+                continue
+            record = json.loads(lines[-1])
+            if record["errors"]:
+                print(f"uhoh, {record['errors']} errors in that run")
+            if record.get("noise", {}).get("jittery_cpus"):
+                print(f"uhoh, that run used jittery cpus {record['noise']['jittery_cpus']}")
+
+            jsonl_file.write(lines[-1] + "\n")
+            writer.writerow(row_from(config, cell, order, record))
+            jsonl_file.flush()
+            csv_file.flush()
+            os.fsync(csv_file.fileno())
+
+    print(f"dataset in {csv_path}, raw records in {jsonl_path}")
+    if failures:
+        print(f"{failures} cells failed, rerun to retry them")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,346 @@
+/* tracefs.c - count TLB flushes by reason, cpu, and size while a run is going
+ *
+ * on x86 the tlb:tlb_flush tracepoint says why each flush happened ("remote shootdown", "local
+ * shootdown", ...) and how many pages it covered. where that tracepoint doesn't exist (riscv),
+ * kprobes on flush_tlb_mm_range() and flush_tlb_page() stand in, with the function as the reason.
+ * events go to a private tracefs instance, so whatever else is tracing isn't disturbed, and a
+ * forked reader process drains its trace_pipe into counters in shared memory. forked, because a
+ * thread would join the measured mm's cpumask and could be shot down itself.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>     // for PATH_MAX
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "microbenchmark.h"
+
+#define INSTANCE "smokewagon-microbenchmark"
+#define KPROBE_GROUP "smokewagon"
+
+static const char* tracefs_roots[] = { "/sys/kernel/tracing", "/sys/kernel/debug/tracing", NULL };
+
+static int write_file(const char* dir, const char* file, const char* value, bool append) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_WRONLY | (append ? O_APPEND : O_TRUNC));
+    if (fd == -1) return -1;
+    ssize_t len = write(fd, value, strlen(value));
+    close(fd);
+    return len == (ssize_t) strlen(value) ? 0 : -1;
+}
+
+static size_t counts_size(const struct flush_trace* ft) {
+    return sizeof(struct flush_counts) + FLUSH_REASONS * ft->nr_cpus * sizeof(unsigned long);
+}
+
+static bool exists(const char* dir, const char* file) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    return access(path, F_OK) == 0;
+}
+
+// histogram bucket for a flush of this many pages: floor(log2(pages)), with the last for full flushes
+static int bucket(long pages) {
+    if (pages < 0) return FLUSH_BUCKETS - 1;
+    int b = 0;
+    while (pages > 1 && b < FLUSH_BUCKETS - 2) {
+        pages >>= 1;
+        b++;
+    }
+    return b;
+}
+
+static int reason_index(struct flush_trace* ft, const char* reason, size_t len) {
+    for (int r = 0; r < ft->counts->nr_reasons; r++) {
+        if (strlen(ft->counts->reasons[r]) == len && !strncmp(ft->counts->reasons[r], reason, len)) return r;
+    }
+    if (ft->counts->nr_reasons == FLUSH_REASONS) return -1;
+    int r = ft->counts->nr_reasons++;
+    snprintf(ft->counts->reasons[r], sizeof(ft->counts->reasons[r]), "%.*s", (int) len, reason);
+    return r;
+}
+
+// "  task-123  [003] d..1.  45.678: tlb_flush: pages:1 reason:remote shootdown (1)"
+// "  task-123  [003] d..1.  45.678: flush_tlb_mm_range: (flush_tlb_mm_range+0x0/0x80) start=0x7f.. end=0x7f.."
+static void parse_line(struct flush_trace* ft, const char* line) {
+    const char* open = strchr(line, '[');
+    if (!open) return;
+    long cpu = strtol(open + 1, NULL, 10);
+    if (cpu < 0 || cpu >= ft->nr_cpus) return;
+
+    const char* reason;
+    size_t reason_len;
+    long pages;
+    const char* p;
+    if ((p = strstr(open, " tlb_flush: pages:"))) {
+        pages = strtol(p + strlen(" tlb_flush: pages:"), NULL, 10);
+        reason = strstr(p, "reason:");
+        if (!reason) return;
+        reason += strlen("reason:");
+        const char* paren = strstr(reason, " (");
+        reason_len = paren ? (size_t) (paren - reason) : strcspn(reason, "\n");
+    } else if ((p = strstr(open, " flush_tlb_mm_range: ")) || (p = strstr(open, " flush_tlb_page: "))) {
+        reason = p + 1;
+        reason_len = strcspn(reason, ":");
+        const char* start = strstr(p, "start=");
+        const char* end = strstr(p, "end=");
+        if (start && end) {
+            unsigned long s = strtoul(start + strlen("start="), NULL, 16);
+            unsigned long e = strtoul(end + strlen("end="), NULL, 16);
+            pages = e == ULONG_MAX ? -1 : (long) ((e - s + PAGE_SIZE - 1) / PAGE_SIZE);
+        } else {
+            pages = 1;
+        }
+    } else {
+        return;
+    }
+
+    int r = reason_index(ft, reason, reason_len);
+    if (r < 0) return;
+    ft->counts->per_cpu[r * ft->nr_cpus + cpu]++;
+    ft->counts->pages[r][bucket(pages)]++;
+}
+
+static void pin(long cpu) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (cpu >= 0) {
+        CPU_SET(cpu, &cpuset);
+    } else {
+        for (long c = 0; c < CPU_SETSIZE; c++) CPU_SET(c, &cpuset);
+    }
+    sched_setaffinity(0, sizeof(cpu_set_t), &cpuset);
+}
+
+// the reader process: parse whatever trace_pipe has until told to quit, and whenever it's empty,
+// own up to having drained everything asked for so far
+static void read_pipe(struct flush_trace* ft) {
+    char path[PATH_MAX];
+    char buf[65536];
+    char line[1024];
+    size_t line_len = 0;
+    unsigned long generation = 0;
+
+    prctl(PR_SET_PDEATHSIG, SIGKILL); // don't outlive a driver that bailed out
+    snprintf(path, sizeof(path), "%s/trace_pipe", ft->dir);
+    int fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (fd == -1) _exit(1);
+
+    while (!atomic_load(&ft->counts->quit)) {
+        if (atomic_load(&ft->counts->generation) != generation) {
+            generation = atomic_load(&ft->counts->generation);
+            pin(atomic_load(&ft->counts->cpu));
+        }
+        // an empty read only answers drain requests made before it
+        unsigned long drain = atomic_load(&ft->counts->drain);
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len <= 0) {
+            atomic_store(&ft->counts->drained, drain);
+            usleep(1000);
+            continue;
+        }
+        for (ssize_t i = 0; i < len; i++) {
+            if (buf[i] == '\n' || line_len == sizeof(line) - 1) {
+                line[line_len] = '\0';
+                parse_line(ft, line);
+                line_len = 0;
+            } else {
+                line[line_len++] = buf[i];
+            }
+        }
+    }
+    close(fd);
+    _exit(0);
+}
+
+static void add_kprobe(struct flush_trace* ft, const char* function, const char* args) {
+    char probe[256];
+    snprintf(probe, sizeof(probe), "p:%s/%s %s %s\n", KPROBE_GROUP, function, function, args);
+    if (write_file(ft->root, "kprobe_events", probe, true)) {
+        // older kernels or other archs may not fetch $argN, so settle for just counting calls
+        snprintf(probe, sizeof(probe), "p:%s/%s %s\n", KPROBE_GROUP, function, function);
+        if (write_file(ft->root, "kprobe_events", probe, true)) {
+            printf("couldn't add a kprobe on %s: %s\n", function, strerror(errno));
+            return;
+        }
+    }
+    snprintf(ft->events[ft->nr_events++], sizeof(ft->events[0]), "events/%s/%s/enable", KPROBE_GROUP, function);
+}
+
+int flush_trace_setup(struct flush_trace* ft, long nr_cpus, long buffer_kb) {
+    memset(ft, 0, sizeof(*ft));
+    ft->nr_cpus = nr_cpus;
+    ft->reader = -1;
+
+    for (int i = 0; tracefs_roots[i]; i++) {
+        if (exists(tracefs_roots[i], "instances")) {
+            snprintf(ft->root, sizeof(ft->root), "%s", tracefs_roots[i]);
+            break;
+        }
+    }
+    if (!ft->root[0]) {
+        printf("no tracefs found, try mount -t tracefs nodev /sys/kernel/tracing\n");
+        return -1;
+    }
+
+    snprintf(ft->dir, sizeof(ft->dir), "%s/instances/%s", ft->root, INSTANCE);
+    if (mkdir(ft->dir, 0700) && errno != EEXIST) {
+        printf("couldn't create tracefs instance %s: %s\n", ft->dir, strerror(errno));
+        return -1;
+    }
+
+    if (exists(ft->dir, "events/tlb/tlb_flush")) {
+        ft->source = "tracepoint";
+        snprintf(ft->events[ft->nr_events++], sizeof(ft->events[0]), "events/tlb/tlb_flush/enable");
+    } else {
+        ft->source = "kprobe";
+        add_kprobe(ft, "flush_tlb_mm_range", "start=$arg2:x64 end=$arg3:x64");
+        add_kprobe(ft, "flush_tlb_page", "start=$arg2:x64");
+        if (!ft->nr_events) {
+            printf("neither the tlb:tlb_flush tracepoint nor flush kprobes are available\n");
+            return -1;
+        }
+    }
+
+    char size[32];
+    snprintf(size, sizeof(size), "%ld", buffer_kb);
+    write_file(ft->dir, "buffer_size_kb", size, false);
+
+    // counters the reader process fills in, and we read
+    ft->counts = mmap(NULL, counts_size(ft), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (ft->counts == MAP_FAILED) {
+        ft->counts = NULL;
+        printf("flush counter mmap() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // forked once, now, while there's little to copy. forking per run would leave the parent's
+    // pages copy-on-write, and breaking that during the run would show up as flushes of its own
+    ft->reader = fork();
+    if (ft->reader == -1) {
+        printf("couldn't fork the trace reader: %s\n", strerror(errno));
+        return -1;
+    }
+    if (ft->reader == 0) {
+        read_pipe(ft);
+    }
+    return 0;
+}
+
+int flush_trace_start(struct flush_trace* ft, long cpu) {
+    struct flush_counts* c = ft->counts;
+
+    // the reader is idle: events are off and it drained the pipe at the last stop
+    write_file(ft->dir, "trace", "", false); // clears the buffer
+    c->nr_reasons = 0;
+    memset(c->reasons, 0, sizeof(c->reasons));
+    memset(c->pages, 0, sizeof(c->pages));
+    memset(c->per_cpu, 0, FLUSH_REASONS * ft->nr_cpus * sizeof(unsigned long));
+    atomic_store(&c->cpu, cpu);
+    atomic_fetch_add(&c->generation, 1);
+
+    for (int e = 0; e < ft->nr_events; e++) {
+        if (write_file(ft->dir, ft->events[e], "1", false)) {
+            printf("couldn't enable %s: %s\n", ft->events[e], strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void flush_trace_stop(struct flush_trace* ft) {
+    struct flush_counts* c = ft->counts;
+    char path[PATH_MAX];
+    char line[256];
+
+    for (int e = 0; e < ft->nr_events; e++) {
+        write_file(ft->dir, ft->events[e], "0", false);
+    }
+    // wait for the reader to come up empty after we asked
+    unsigned long drain = atomic_fetch_add(&c->drain, 1) + 1;
+    while (atomic_load(&c->drained) < drain) {
+        if (waitpid(ft->reader, NULL, WNOHANG) == ft->reader) {
+            printf("uhoh, the trace reader died, flush counts are incomplete\n");
+            ft->reader = -1;
+            break;
+        }
+        usleep(1000);
+    }
+
+    // anything the reader couldn't keep up with
+    ft->overrun = 0;
+    for (long cpu = 0; cpu < ft->nr_cpus; cpu++) {
+        snprintf(path, sizeof(path), "%s/per_cpu/cpu%ld/stats", ft->dir, cpu);
+        FILE* f = fopen(path, "r");
+        if (!f) continue;
+        while (fgets(line, sizeof(line), f)) {
+            if (!strncmp(line, "overrun:", 8)) ft->overrun += strtoul(line + 8, NULL, 10);
+        }
+        fclose(f);
+    }
+}
+
+void flush_trace_print(const struct flush_trace* ft) {
+    for (int r = 0; r < ft->counts->nr_reasons; r++) {
+        unsigned long total = 0;
+        for (long cpu = 0; cpu < ft->nr_cpus; cpu++) {
+            total += ft->counts->per_cpu[r * ft->nr_cpus + cpu];
+        }
+        printf("%lu %s flushes (%lu full)\n", total, ft->counts->reasons[r], ft->counts->pages[r][FLUSH_BUCKETS - 1]);
+    }
+    if (ft->overrun) {
+        printf("uhoh, %lu trace events were overwritten before they could be read, try a larger buffer\n", ft->overrun);
+    }
+}
+
+void flush_trace_write(FILE* f, const struct flush_trace* ft) {
+    fprintf(f, "\"tlb_trace\": {\"source\": \"%s\", \"overrun\": %lu, \"reasons\": {", ft->source, ft->overrun);
+    for (int r = 0; r < ft->counts->nr_reasons; r++) {
+        fprintf(f, "%s", r ? ", " : "");
+        json_string(f, ft->counts->reasons[r]);
+        fprintf(f, ": {\"per_cpu\": [");
+        for (long cpu = 0; cpu < ft->nr_cpus; cpu++) {
+            fprintf(f, "%s%lu", cpu ? ", " : "", ft->counts->per_cpu[r * ft->nr_cpus + cpu]);
+        }
+        // pages_log2[b] counts flushes of 2^b to 2^(b+1)-1 pages
+        fprintf(f, "], \"pages_log2\": [");
+        for (int b = 0; b < FLUSH_BUCKETS - 1; b++) {
+            fprintf(f, "%s%lu", b ? ", " : "", ft->counts->pages[r][b]);
+        }
+        fprintf(f, "], \"full\": %lu}", ft->counts->pages[r][FLUSH_BUCKETS - 1]);
+    }
+    fprintf(f, "}}");
+}
+
+void flush_trace_teardown(struct flush_trace* ft) {
+    char probe[128];
+
+    if (ft->reader > 0) {
+        atomic_store(&ft->counts->quit, true);
+        waitpid(ft->reader, NULL, 0);
+    }
+    for (int e = 0; e < ft->nr_events; e++) {
+        write_file(ft->dir, ft->events[e], "0", false);
+    }
+    if (ft->dir[0]) rmdir(ft->dir);
+    if (ft->source && !strcmp(ft->source, "kprobe")) {
+        snprintf(probe, sizeof(probe), "-:%s/flush_tlb_mm_range\n", KPROBE_GROUP);
+        write_file(ft->root, "kprobe_events", probe, true);
+        snprintf(probe, sizeof(probe), "-:%s/flush_tlb_page\n", KPROBE_GROUP);
+        write_file(ft->root, "kprobe_events", probe, true);
+    }
+    if (ft->counts) {
+        munmap(ft->counts, counts_size(ft));
+    }
+}
@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""vmtrace.py - turn strace output into a VM syscall trace microbenchmark-replay can run
+
+record:  strace -f -ttt -e trace=mmap,munmap,mprotect,madvise,mremap -o httpd.strace \\
+             /opt/smokewagon/httpd/bin/httpd -X -f $PWD/apache/httpd.conf
+convert: ./vmtrace.py httpd.strace > httpd.vmtrace
+replay:  ./microbenchmark-replay -s httpd.vmtrace
+
+strace, rather than an LD_PRELOAD shim, because glibc's own mmaps (malloc arenas, thread stacks,
+dlopen) never go through an interposable symbol. every successful call becomes one line, per thread,
+with its time since the first call. addresses become offsets into a compact arena: every range the
+trace touches is clustered with its neighbours (anything within CLUSTER_GAP), and the clusters are
+laid out one after another, 1 GB aligned so THP alignment survives. the replayer reserves the arena
+and runs each call at the same offset, so what was adjacent stays adjacent.
+
+file mappings are replayed as anonymous ones of the same kind, since the files won't be there;
+MAP_HUGETLB, MAP_GROWSDOWN, and PROT_GROWSDOWN/UP are dropped, and brk isn't traced at all.
+
+output, after a "# vmtrace 1 <arena_bytes> <threads> <calls>" header:
+  <thread> <t_us> mmap <offset> <len> <prot> <flags>
+  <thread> <t_us> munmap <offset> <len>
+  <thread> <t_us> mprotect <offset> <len> <prot>
+  <thread> <t_us> madvise <offset> <len> <advice>
+  <thread> <t_us> mremap <offset> <old_len> <new_len> <flags> <new_offset>
+"""
+
+import re
+import sys
+
+GB = 1 << 30
+CLUSTER_GAP = 256 << 20
+PAGE = 4096
+
+PROT = {"PROT_NONE": 0, "PROT_READ": 1, "PROT_WRITE": 2, "PROT_EXEC": 4}
+MAP = {
+    "MAP_SHARED": 0x01, "MAP_PRIVATE": 0x02, "MAP_SHARED_VALIDATE": 0x03, "MAP_ANONYMOUS": 0x20,
+    "MAP_NORESERVE": 0x4000, "MAP_POPULATE": 0x8000, "MAP_STACK": 0x20000, "MAP_PRIVATE_TLB": 0x200000,
+    "MAP_SYNC": 0x80000, "MAP_UNINITIALIZED": 0x4000000, "MAP_LOCKED": 0x2000, "MAP_NONBLOCK": 0x10000,
+    "MAP_FIXED": 0x10, "MAP_FIXED_NOREPLACE": 0x100000,
+}
+# dropped, the replayer has no files, hugetlb pool, or stack vmas. MAP_FIXED stays, it tells the
+# replayer the app meant to map over whatever was there
+MAP_IGNORED = {"MAP_DENYWRITE", "MAP_EXECUTABLE", "MAP_FILE",
+               "MAP_GROWSDOWN", "MAP_HUGETLB", "MAP_HUGE_2MB", "MAP_HUGE_1GB", "MAP_32BIT"}
+MADV = {
+    "MADV_NORMAL": 0, "MADV_RANDOM": 1, "MADV_SEQUENTIAL": 2, "MADV_WILLNEED": 3, "MADV_DONTNEED": 4,
+    "MADV_FREE": 8, "MADV_REMOVE": 9, "MADV_DONTFORK": 10, "MADV_DOFORK": 11, "MADV_MERGEABLE": 12,
+    "MADV_UNMERGEABLE": 13, "MADV_HUGEPAGE": 14, "MADV_NOHUGEPAGE": 15, "MADV_DONTDUMP": 16,
+    "MADV_DODUMP": 17, "MADV_WIPEONFORK": 18, "MADV_KEEPONFORK": 19, "MADV_COLD": 20, "MADV_PAGEOUT": 21,
+    "MADV_POPULATE_READ": 22, "MADV_POPULATE_WRITE": 23, "MADV_DONTNEED_LOCKED": 24, "MADV_COLLAPSE": 25,
+    "MADV_PRIVATE_TLB": 26, "MADV_NORMAL_TLB": 27, "MADV_GUARD_INSTALL": 102, "MADV_GUARD_REMOVE": 103,
+}
+MREMAP = {"MREMAP_MAYMOVE": 1, "MREMAP_FIXED": 2, "MREMAP_DONTUNMAP": 4}
+
+# [pid]  seconds.micros  call(args) = result  [<duration>]
+CALL = re.compile(r"^(?:(\d+)\s+)?(\d+\.\d+)\s+(\w+)\((.*)\)\s+=\s+(-?\w+)")
+UNFINISHED = re.compile(r"^(?:(\d+)\s+)?(\d+\.\d+)\s+(\w+)\((.*?)\s*<unfinished \.\.\.>")
+RESUMED = re.compile(r"^(?:(\d+)\s+)?\d+\.\d+\s+<\.\.\. (\w+) resumed>\s*(.*)\)\s+=\s+(-?\w+)")
+
+
+def number(text):
+    # "4096", "0x7f00", "3</usr/lib/libc.so.6>", "0x1a /* MADV_??? */"
+    return int(re.match(r"-?(0x[0-9a-fA-F]+|\d+)", text.strip()).group(0), 0)
+
+
+def symbols(text, table, ignored=frozenset()):
+    value = 0
+    for part in text.strip().split("|"):
+        part = part.split("/*")[0].strip()
+        if part in table:
+            value |= table[part]
+        elif part in ignored or part.startswith("MAP_HUGE_") or part in ("PROT_GROWSDOWN", "PROT_GROWSUP"):
+            continue
+        else:
+            value |= number(part)
+    return value
+
+
+def parse(lines):
+    """(tid, seconds, call, args, result) for every finished, successful call"""
+    pending = {}
+    for line in lines:
+        m = UNFINISHED.match(line)
+        if m:
+            pending[(m.group(1), m.group(3))] = (m.group(2), m.group(4))
+            continue
+        m = RESUMED.match(line)
+        if m:
+            tid, call, rest, result = m.groups()
+            if (tid, call) not in pending:
+                continue
+            when, start = pending.pop((tid, call))
+            args = start + rest
+        else:
+            m = CALL.match(line)
+            if not m:
+                continue
+            tid, when, call, args, result = m.groups()
+        if result.startswith("-"):
+            continue
+        if call == "mmap2":
+            call = "mmap"
+        if call in ("mmap", "munmap", "mprotect", "madvise", "mremap"):
+            yield tid or "0", float(when), call, [a.strip() for a in args.split(",")], result
+
+
+def page_up(n):
+    return (n + PAGE - 1) // PAGE * PAGE
+
+
+def convert(calls):
+    events = []
+    ranges = []
+    for tid, when, call, args, result in calls:
+        if call == "mmap":
+            length = page_up(number(args[1]))
+            prot = symbols(args[2], PROT)
+            flags = symbols(args[3], MAP, MAP_IGNORED)
+            if number(args[4]) != -1 or not flags & MAP["MAP_ANONYMOUS"]:
+                flags |= MAP["MAP_ANONYMOUS"]
+            address = number(result)
+            events.append((tid, when, call, address, [length, prot, flags]))
+            ranges.append((address, length))
+        elif call == "mremap":
+            address, old_len, new_len = number(args[0]), page_up(number(args[1])), page_up(number(args[2]))
+            flags = symbols(args[3], MREMAP)
+            new_address = number(result)
+            events.append((tid, when, call, address, [old_len, new_len, flags, new_address]))
+            ranges.append((address, old_len))
+            ranges.append((new_address, new_len))
+        else:
+            address, length = number(args[0]), page_up(number(args[1]))
+            extra = []
+            if call == "mprotect":
+                extra = [symbols(args[2], PROT)]
+            elif call == "madvise":
+                extra = [symbols(args[2], MADV)]
+            events.append((tid, when, call, address, [length] + extra))
+            ranges.append((address, length))
+
+    # cluster everything the trace touched, then lay the clusters out 1 GB aligned
+    clusters = []
+    for start, length in sorted(ranges):
+        if clusters and start <= clusters[-1][1] + CLUSTER_GAP:
+            clusters[-1][1] = max(clusters[-1][1], start + length)
+        else:
+            clusters.append([start, start + length])
+    bases = []
+    arena = 0
+    for start, end in clusters:
+        aligned = start // GB * GB
+        bases.append((start, end, aligned, arena))
+        arena += -(-(end - aligned) // GB) * GB + GB  # and a GB of guard
+
+    def offset(address):
+        for start, end, aligned, base in bases:
+            if start <= address <= end:
+                return base + address - aligned
+        raise ValueError(f"address {address:#x} isn't in any cluster")
+
+    threads = {}
+    first = events[0][1] if events else 0
+    out = []
+    for tid, when, call, address, rest in events:
+        thread = threads.setdefault(tid, len(threads))
+        if call == "mremap":
+            rest = rest[:3] + [offset(rest[3])]
+        out.append(f"{thread} {int((when - first) * 1e6)} {call} {offset(address)} " + " ".join(str(x) for x in rest))
+    return arena, len(threads), out
+
+
+def main():
+    if len(sys.argv) != 2 or sys.argv[1] in ("-h", "--help"):
+        print(__doc__)
+        return 1
+    with open(sys.argv[1]) as f:
+        arena, threads, lines = convert(list(parse(f)))
+    if not lines:
+        print(f"no successful mmap/munmap/mprotect/madvise/mremap calls in {sys.argv[1]}, was strace run with -ttt?", file=sys.stderr)
+        return 1
+    print(f"# vmtrace 1 {arena} {threads} {len(lines)}")
+    print("\n".join(lines))
+    print(f"{len(lines)} calls from {threads} threads, {arena >> 30} GB arena", file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,202 @@
+/* workload-mmap.c - each thread mmap-touches-munmaps -p pages at a time, over one of several backings
+ *
+ * the flush and rmap paths differ by what's behind the mapping, so there's a variant per backing:
+ * private and shared anonymous memory are written, while memfd, a file in /dev/shm (tmpfs), and a
+ * file in -D's directory (the page cache of whatever filesystem that is) are read back. the driver
+ * records the filesystem behind file-backed variants.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>      // for open()
+#include <limits.h>     // for PATH_MAX
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "microbenchmark.h"
+
+enum backing {
+    PRIVATE_ANON,
+    SHARED_ANON,
+    MEMFD,
+    SHMEM,      // a file on tmpfs
+    FILE_DIR,   // a file in -D's directory
+};
+
+static bool anonymous(enum backing backing) {
+    return backing == PRIVATE_ANON || backing == SHARED_ANON;
+}
+
+// where a thread's file lives, or "" for memfd
+static void temp_path(char* path, size_t size, enum backing backing, int tid) {
+    const char* dir = backing == SHMEM ? "/dev/shm" : file_dir;
+    path[0] = '\0';
+    if (backing == SHMEM || backing == FILE_DIR) {
+        snprintf(path, size, "%s/microbenchmark-%s-temp-%02d", dir, backing == SHMEM ? "shmem" : "filebacked", tid);
+    }
+}
+
+static int mmap_setup(struct per_thread_info* info, enum backing backing) {
+    size_t size = pages * PAGE_SIZE;
+
+    // punch a hole at the start of our region that we'll map into later
+    info->my_page = info->region;
+    munmap(info->my_page, size);
+
+    // each thread gets a bystander page to prevent freed_pages full-mm shootdown
+    info->bystander_page = info->my_page + size;
+    mprotect(info->bystander_page, PAGE_SIZE, PROT_READ|PROT_WRITE);
+    info->bystander_page[0] = 'x';
+
+    if (anonymous(backing)) {
+        info->fd = -1;
+        return 0;
+    }
+
+    // open a file, or memfd, for each thread
+    char filename[PATH_MAX];
+    temp_path(filename, sizeof(filename), backing, info->tid);
+    if (backing == MEMFD) {
+        info->fd = memfd_create("microbenchmark", 0);
+    } else {
+        info->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    }
+    if (info->fd == -1) {
+        printf("file opening error for %s!\n", backing == MEMFD ? "memfd" : filename);
+        return -1;
+    }
+
+    // extend file, -p pages per thread
+    if (ftruncate(info->fd, size)) {
+        printf("file truncation error!\n");
+        close(info->fd);
+        return -1;
+    }
+
+    // mmap file and write for warmup
+    char* ptr = mmap(info->my_page, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED_NOREPLACE, info->fd, 0);
+    if (ptr == MAP_FAILED) {
+        printf("mmap() for tid: %d failed, ptr == MAP_FAILED\n", info->tid);
+        return -1;
+    } else if (ptr != info->my_page) {
+        printf("mmap() for tid: %d problem, ptr != info->my_page\n", info->tid);
+        return -1;
+    }
+    for (long i = 0; i < pages; i++) {
+        ptr[i * PAGE_SIZE] = 'y';
+    }
+    munmap(ptr, size);
+
+    return 0;
+}
+
+static int mmap_op(struct per_thread_info* info, enum backing backing) {
+    bool filebacked = !anonymous(backing);
+    int mmap_flags = MAP_FIXED_NOREPLACE | (backing == PRIVATE_ANON ? MAP_PRIVATE : MAP_SHARED) |
+        (filebacked ? 0 : MAP_ANONYMOUS) | (smokewagon ? MAP_PRIVATE_TLB : 0);
+    size_t size = pages * PAGE_SIZE;
+
+    // mmap the thread's pages in the file
+    char* ptr = mmap(info->my_page, size, filebacked ? PROT_READ : PROT_READ|PROT_WRITE, mmap_flags, info->fd, 0);
+    if (ptr == MAP_FAILED) {
+        printf("mmap() for tid: %d failed, ptr == MAP_FAILED\n", info->tid);
+        return -1;
+    } else if (ptr != info->my_page) {
+        printf("mmap() for tid: %d problem, ptr != info->my_page\n", info->tid);
+        return -1;
+    }
+
+    // read file or write anonymous memory, a byte per page
+    for (long i = 0; i < pages; i++) {
+        if (filebacked) {
+            if (ptr[i * PAGE_SIZE] != 'y') {
+                printf("uhoh, tid: %d misplaced its page somehow\n", info->tid);
+                info->errors++;
+            }
+        } else {
+            ptr[i * PAGE_SIZE] = 'y';
+        }
+    }
+
+    // munmap pages
+    munmap(ptr, size);
+
+    return 0;
+}
+
+static bool mmap_verify(struct per_thread_info* info) {
+    return info->bystander_page[0] == 'x';
+}
+
+static void mmap_teardown(struct per_thread_info* info, enum backing backing) {
+    if (info->fd == -1) return;
+
+    close(info->fd);
+    char filename[PATH_MAX];
+    temp_path(filename, sizeof(filename), backing, info->tid);
+    if (filename[0]) {
+        remove(filename);
+    }
+}
+
+static int private_setup(struct per_thread_info* info) { return mmap_setup(info, PRIVATE_ANON); }
+static int membacked_setup(struct per_thread_info* info) { return mmap_setup(info, SHARED_ANON); }
+static int memfd_setup(struct per_thread_info* info) { return mmap_setup(info, MEMFD); }
+static int shmem_setup(struct per_thread_info* info) { return mmap_setup(info, SHMEM); }
+static int filebacked_setup(struct per_thread_info* info) { return mmap_setup(info, FILE_DIR); }
+static int private_op(struct per_thread_info* info, unsigned long iteration) { (void) iteration; return mmap_op(info, PRIVATE_ANON); }
+static int membacked_op(struct per_thread_info* info, unsigned long iteration) { (void) iteration; return mmap_op(info, SHARED_ANON); }
+static int memfd_op(struct per_thread_info* info, unsigned long iteration) { (void) iteration; return mmap_op(info, MEMFD); }
+static int shmem_op(struct per_thread_info* info, unsigned long iteration) { (void) iteration; return mmap_op(info, SHMEM); }
+static int filebacked_op(struct per_thread_info* info, unsigned long iteration) { (void) iteration; return mmap_op(info, FILE_DIR); }
+static void private_teardown(struct per_thread_info* info) { mmap_teardown(info, PRIVATE_ANON); }
+static void membacked_teardown(struct per_thread_info* info) { mmap_teardown(info, SHARED_ANON); }
+static void memfd_teardown(struct per_thread_info* info) { mmap_teardown(info, MEMFD); }
+static void shmem_teardown(struct per_thread_info* info) { mmap_teardown(info, SHMEM); }
+static void filebacked_teardown(struct per_thread_info* info) { mmap_teardown(info, FILE_DIR); }
+
+const struct workload workload_mmap_private = {
+    .name = "mmap-private",
+    .description = "mmap-write-munmap anonymous private pages",
+    .setup = private_setup,
+    .op = private_op,
+    .verify = mmap_verify,
+    .teardown = private_teardown,
+};
+
+const struct workload workload_mmap_membacked = {
+    .name = "mmap-membacked",
+    .description = "mmap-write-munmap anonymous shared pages",
+    .setup = membacked_setup,
+    .op = membacked_op,
+    .verify = mmap_verify,
+    .teardown = membacked_teardown,
+};
+
+const struct workload workload_mmap_memfd = {
+    .name = "mmap-memfd",
+    .description = "mmap-read-munmap pages of a per-thread memfd",
+    .setup = memfd_setup,
+    .op = memfd_op,
+    .verify = mmap_verify,
+    .teardown = memfd_teardown,
+};
+
+const struct workload workload_mmap_shmem = {
+    .name = "mmap-shmem",
+    .description = "mmap-read-munmap pages of a per-thread file in /dev/shm",
+    .setup = shmem_setup,
+    .op = shmem_op,
+    .verify = mmap_verify,
+    .teardown = shmem_teardown,
+};
+
+const struct workload workload_mmap_filebacked = {
+    .name = "mmap-filebacked",
+    .description = "mmap-read-munmap pages of a per-thread file in -D's directory",
+    .setup = filebacked_setup,
+    .op = filebacked_op,
+    .verify = mmap_verify,
+    .teardown = filebacked_teardown,
+};
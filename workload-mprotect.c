@@ -0,0 +1,92 @@
+/* workload-mprotect.c - each thread flips its pages' protection to write them and back to read them
+ *
+ * mprotect-shootdown alternates PROT_WRITE and PROT_READ, so every read-only downgrade has to flush.
+ * mprotect-noprotchange asks for PROT_READ|PROT_WRITE both times, so the same syscalls never flush.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "microbenchmark.h"
+
+// at least 2MB of our region, to keep away from other threads' PTE locks
+static size_t mapping_size(void) {
+    return (pages * PAGE_SIZE + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+}
+
+static int mprotect_setup(struct per_thread_info* info) {
+    size_t size = pages * PAGE_SIZE;
+
+    info->my_page = mmap(info->region, mapping_size(), PROT_NONE, MAP_ANON|MAP_SHARED|MAP_FIXED, -1, 0);
+    if (info->my_page == MAP_FAILED) {
+        printf("mmap() failed with MAP_FAILED: %s\n", strerror(errno));
+        return -1;
+    }
+    if (mprotect(info->my_page, size, PROT_READ|PROT_WRITE)) { // make thread's pages writable
+        printf("mprotect() for tid: %d failed: %s\n", info->tid, strerror(errno));
+        return -1;
+    }
+    for (long i = 0; i < pages; i++) {
+        ((unsigned long*) (info->my_page + i * PAGE_SIZE))[0] = 0; // fault-in thread's pages
+    }
+
+    madvise(info->my_page, size, smokewagon ? MADV_PRIVATE_TLB : MADV_NORMAL_TLB);
+    return 0;
+}
+
+static int mprotect_op(struct per_thread_info* info, unsigned long iteration, int protwrite, int protread) {
+    size_t size = pages * PAGE_SIZE;
+
+    // write pages
+    if (mprotect(info->my_page, size, protwrite)) {
+        printf("mprotect() for tid: %d failed: %s\n", info->tid, strerror(errno));
+        return -1;
+    }
+    for (long i = 0; i < pages; i++) {
+        ((unsigned long*) (info->my_page + i * PAGE_SIZE))[0] = iteration;
+    }
+
+    // read pages
+    if (mprotect(info->my_page, size, protread)) {
+        printf("mprotect() for tid: %d failed: %s\n", info->tid, strerror(errno));
+        return -1;
+    }
+    for (long i = 0; i < pages; i++) {
+        if (((unsigned long*) (info->my_page + i * PAGE_SIZE))[0] != iteration) {
+            info->errors++;
+        }
+    }
+
+    return 0;
+}
+
+static int shootdown_op(struct per_thread_info* info, unsigned long iteration) {
+    return mprotect_op(info, iteration, PROT_WRITE, PROT_READ);
+}
+
+static int noprotchange_op(struct per_thread_info* info, unsigned long iteration) {
+    return mprotect_op(info, iteration, PROT_READ|PROT_WRITE, PROT_READ|PROT_WRITE);
+}
+
+static void mprotect_teardown(struct per_thread_info* info) {
+    munmap(info->my_page, mapping_size());
+}
+
+const struct workload workload_mprotect_shootdown = {
+    .name = "mprotect-shootdown",
+    .description = "mprotect write, write, mprotect read, read -p pages",
+    .setup = mprotect_setup,
+    .op = shootdown_op,
+    .teardown = mprotect_teardown,
+};
+
+const struct workload workload_mprotect_noprotchange = {
+    .name = "mprotect-noprotchange",
+    .description = "same as mprotect-shootdown, but always PROT_READ|PROT_WRITE",
+    .setup = mprotect_setup,
+    .op = noprotchange_op,
+    .teardown = mprotect_teardown,
+};
@@ -0,0 +1,379 @@
+/* workload-scan.c - each thread streams through its share of one big file, -p pages at a time
+ *
+ * the file is -z MiB in -D's directory, written once at setup so every page starts with its own page
+ * number, and split evenly between the most threads any run will have. every op reads the next
+ * -p page window of the thread's share, wrapping around at the end, and checks each page's number:
+ *
+ *   scan-mmap              mmap the window, read it, munmap it, like a sliding window over a file
+ *   scan-mmap-populate     the same with MAP_POPULATE, so the faults all happen inside mmap()
+ *   scan-mmap-sequential   the same with MADV_SEQUENTIAL on every window
+ *   scan-pread             pread() the window into a buffer that's reused every time
+ *   scan-uring             io_uring reads of the window into a reused buffer, in up to 8 pieces at
+ *                          once, through raw syscalls so there's no liburing to install
+ *
+ * the file was just written, so this is a warm page cache scan: what's measured is the cost of
+ * getting at cached data, mappings and flushes included, not the disk.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>     // for PATH_MAX
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "microbenchmark.h"
+
+#define URING_PIECES 8
+
+enum scan {
+    SCAN_MMAP,
+    SCAN_MMAP_POPULATE,
+    SCAN_MMAP_SEQUENTIAL,
+    SCAN_PREAD,
+    SCAN_URING,
+};
+
+struct scan_state {
+    off_t share;                // where this thread's share of the file starts
+    off_t share_size;           // a whole number of windows
+    off_t cursor;               // the next window, from share
+    char* buffer;               // pread and io_uring read into this
+    unsigned long sink;         // so the compiler can't skip reading the data
+
+    // io_uring
+    int ring_fd;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+};
+
+static void scan_path(char* path, size_t size) {
+    snprintf(path, size, "%s/microbenchmark-scan-temp", file_dir);
+}
+
+// the first thread's setup writes the file, everyone after just opens it
+static int open_file(struct per_thread_info* info) {
+    char filename[PATH_MAX];
+    off_t file_size = (off_t) file_mib << 20;
+
+    scan_path(filename, sizeof(filename));
+    if (info->tid > 0) {
+        info->fd = open(filename, O_RDONLY);
+        if (info->fd == -1) {
+            printf("file opening error for %s: %s\n", filename, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    info->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (info->fd == -1) {
+        printf("file opening error for %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    printf("writing a %ld MiB file to scan\n", file_mib);
+    unsigned long* chunk = malloc(1 << 20);
+    if (!chunk) return -1;
+    memset(chunk, 'y', 1 << 20);
+    for (off_t off = 0; off < file_size; off += 1 << 20) {
+        for (long i = 0; i < (1 << 20) / PAGE_SIZE; i++) {
+            chunk[i * PAGE_SIZE / sizeof(unsigned long)] = off / PAGE_SIZE + i;
+        }
+        if (pwrite(info->fd, chunk, 1 << 20, off) != 1 << 20) {
+            printf("file writing error: %s\n", strerror(errno));
+            free(chunk);
+            return -1;
+        }
+    }
+    free(chunk);
+    return 0;
+}
+
+static int setup_ring(struct scan_state* state) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    state->ring_fd = syscall(__NR_io_uring_setup, URING_PIECES, &params);
+    if (state->ring_fd == -1) {
+        printf("io_uring_setup() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    state->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    state->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (state->cq_ring_size > state->sq_ring_size) state->sq_ring_size = state->cq_ring_size;
+        state->cq_ring_size = 0;
+    }
+    state->sq_ring = mmap(NULL, state->sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, state->ring_fd, IORING_OFF_SQ_RING);
+    state->cq_ring = state->sq_ring;
+    if (state->cq_ring_size) {
+        state->cq_ring = mmap(NULL, state->cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, state->ring_fd, IORING_OFF_CQ_RING);
+    }
+    state->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL, state->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, state->ring_fd, IORING_OFF_SQES);
+    if (state->sq_ring == MAP_FAILED || state->cq_ring == MAP_FAILED || state->sqes == MAP_FAILED) {
+        printf("io_uring ring mmap() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    char* sq = state->sq_ring;
+    char* cq = state->cq_ring;
+    state->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+    state->sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+    state->cq_head = (unsigned*) (cq + params.cq_off.head);
+    state->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+    state->cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+    // sqe i always goes in slot i
+    unsigned* array = (unsigned*) (sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+    return 0;
+}
+
+static int scan_setup(struct per_thread_info* info, enum scan scan) {
+    size_t window = pages * PAGE_SIZE;
+    off_t file_size = (off_t) file_mib << 20;
+
+    struct scan_state* state = calloc(1, sizeof(*state));
+    if (!state) return -1;
+    state->ring_fd = -1;
+    info->workload_data = state;
+
+    // an equal share for each of the most threads we'll run
+    state->share_size = file_size / threads / window * window;
+    state->share = info->tid * state->share_size;
+    if (state->share_size == 0) {
+        printf("a %ld MiB file can't give %ld threads a %ld page window each, try a larger -z or smaller -p\n", file_mib, threads, pages);
+        return -1;
+    }
+
+    if (open_file(info)) return -1;
+
+    if (scan == SCAN_PREAD || scan == SCAN_URING) {
+        state->buffer = aligned_alloc(PAGE_SIZE, window);
+        if (!state->buffer) return -1;
+        memset(state->buffer, 0, window); // fault it in now
+    } else {
+        // punch a hole at the start of our region for the window, with a bystander page after it
+        // to prevent freed_pages full-mm shootdown, like workload-mmap.c
+        info->my_page = info->region;
+        munmap(info->my_page, window);
+        info->bystander_page = info->my_page + window;
+        mprotect(info->bystander_page, PAGE_SIZE, PROT_READ|PROT_WRITE);
+        info->bystander_page[0] = 'x';
+    }
+
+    if (scan == SCAN_URING) {
+        return setup_ring(state);
+    }
+    return 0;
+}
+
+// read every cache line of the window, and check every page is the one we asked for
+static void scan_window(struct per_thread_info* info, const char* data, off_t offset) {
+    struct scan_state* state = info->workload_data;
+    unsigned long sum = 0;
+
+    for (long i = 0; i < pages; i++) {
+        const unsigned long* page = (const unsigned long*) (data + i * PAGE_SIZE);
+        if (page[0] != (unsigned long) (offset / PAGE_SIZE + i)) {
+            printf("uhoh, tid: %d read page %lu where page %lu should be\n", info->tid, page[0], offset / PAGE_SIZE + i);
+            info->errors++;
+        }
+        for (long line = 0; line < PAGE_SIZE / 64; line++) {
+            sum += page[line * 64 / sizeof(unsigned long)];
+        }
+    }
+    state->sink += sum;
+}
+
+static int uring_read(struct per_thread_info* info, off_t offset) {
+    struct scan_state* state = info->workload_data;
+    long pieces = pages < URING_PIECES ? pages : URING_PIECES;
+    long piece_pages = pages / pieces;
+
+    unsigned tail = *state->sq_tail;
+    for (long i = 0; i < pieces; i++) {
+        long first = i * piece_pages;
+        long count = i == pieces - 1 ? pages - first : piece_pages;
+        struct io_uring_sqe* sqe = &state->sqes[(tail + i) & *state->sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = info->fd;
+        sqe->addr = (unsigned long) (state->buffer + first * PAGE_SIZE);
+        sqe->len = count * PAGE_SIZE;
+        sqe->off = offset + first * PAGE_SIZE;
+        sqe->user_data = count * PAGE_SIZE;
+    }
+    __atomic_store_n(state->sq_tail, tail + pieces, __ATOMIC_RELEASE);
+
+    if (syscall(__NR_io_uring_enter, state->ring_fd, pieces, pieces, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+        printf("io_uring_enter() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    unsigned head = *state->cq_head;
+    for (long i = 0; i < pieces; i++) {
+        while (head == __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE)) {
+            syscall(__NR_io_uring_enter, state->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        }
+        struct io_uring_cqe* cqe = &state->cqes[head & *state->cq_mask];
+        if (cqe->res != (int) cqe->user_data) {
+            printf("io_uring read for tid: %d returned %d, not %llu\n", info->tid, cqe->res, cqe->user_data);
+            info->errors++;
+        }
+        head++;
+    }
+    __atomic_store_n(state->cq_head, head, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int scan_op(struct per_thread_info* info, enum scan scan) {
+    struct scan_state* state = info->workload_data;
+    size_t window = pages * PAGE_SIZE;
+    off_t offset = state->share + state->cursor;
+
+    state->cursor += window;
+    if (state->cursor == state->share_size) {
+        state->cursor = 0;
+    }
+
+    if (scan == SCAN_PREAD) {
+        for (size_t done = 0; done < window; ) {
+            ssize_t len = pread(info->fd, state->buffer + done, window - done, offset + done);
+            if (len <= 0) {
+                printf("pread() for tid: %d failed: %s\n", info->tid, len ? strerror(errno) : "end of file");
+                return -1;
+            }
+            done += len;
+        }
+        scan_window(info, state->buffer, offset);
+        return 0;
+    }
+
+    if (scan == SCAN_URING) {
+        if (uring_read(info, offset)) return -1;
+        scan_window(info, state->buffer, offset);
+        return 0;
+    }
+
+    int mmap_flags = MAP_SHARED|MAP_FIXED_NOREPLACE | (scan == SCAN_MMAP_POPULATE ? MAP_POPULATE : 0) | (smokewagon ? MAP_PRIVATE_TLB : 0);
+    char* ptr = mmap(info->my_page, window, PROT_READ, mmap_flags, info->fd, offset);
+    if (ptr == MAP_FAILED) {
+        printf("mmap() for tid: %d failed, ptr == MAP_FAILED\n", info->tid);
+        return -1;
+    } else if (ptr != info->my_page) {
+        printf("mmap() for tid: %d problem, ptr != info->my_page\n", info->tid);
+        return -1;
+    }
+    if (scan == SCAN_MMAP_SEQUENTIAL) {
+        madvise(ptr, window, MADV_SEQUENTIAL);
+    }
+    scan_window(info, ptr, offset);
+    munmap(ptr, window);
+
+    return 0;
+}
+
+static bool scan_verify(struct per_thread_info* info) {
+    return !info->bystander_page || info->bystander_page[0] == 'x';
+}
+
+static void scan_teardown(struct per_thread_info* info) {
+    struct scan_state* state = info->workload_data;
+
+    if (state) {
+        if (state->ring_fd != -1) {
+            if (state->sqes && state->sqes != MAP_FAILED) munmap(state->sqes, state->sqes_size);
+            if (state->cq_ring_size && state->cq_ring && state->cq_ring != MAP_FAILED) munmap(state->cq_ring, state->cq_ring_size);
+            if (state->sq_ring && state->sq_ring != MAP_FAILED) munmap(state->sq_ring, state->sq_ring_size);
+            close(state->ring_fd);
+        }
+        free(state->buffer);
+        free(state);
+        info->workload_data = NULL;
+    }
+    if (info->fd != -1) {
+        close(info->fd);
+    }
+    if (info->tid == 0) {
+        char filename[PATH_MAX];
+        scan_path(filename, sizeof(filename));
+        remove(filename);
+    }
+}
+
+static int mmap_setup(struct per_thread_info* info) { return scan_setup(info, SCAN_MMAP); }
+static int populate_setup(struct per_thread_info* info) { return scan_setup(info, SCAN_MMAP_POPULATE); }
+static int sequential_setup(struct per_thread_info* info) { return scan_setup(info, SCAN_MMAP_SEQUENTIAL); }
+static int pread_setup(struct per_thread_info* info) { return scan_setup(info, SCAN_PREAD); }
+static int uring_setup(struct per_thread_info* info) { return scan_setup(info, SCAN_URING); }
+static int mmap_op(struct per_thread_info* info, unsigned long iteration) { (void) iteration; return scan_op(info, SCAN_MMAP); }
+static int populate_op(struct per_thread_info* info, unsigned long iteration) { (void) iteration; return scan_op(info, SCAN_MMAP_POPULATE); }
+static int sequential_op(struct per_thread_info* info, unsigned long iteration) { (void) iteration; return scan_op(info, SCAN_MMAP_SEQUENTIAL); }
+static int pread_op(struct per_thread_info* info, unsigned long iteration) { (void) iteration; return scan_op(info, SCAN_PREAD); }
+static int uring_op(struct per_thread_info* info, unsigned long iteration) { (void) iteration; return scan_op(info, SCAN_URING); }
+
+const struct workload workload_scan_mmap = {
+    .name = "scan-mmap",
+    .description = "mmap-read-munmap a sliding -p page window over a -z MiB file",
+    .setup = mmap_setup,
+    .op = mmap_op,
+    .verify = scan_verify,
+    .teardown = scan_teardown,
+};
+
+const struct workload workload_scan_mmap_populate = {
+    .name = "scan-mmap-populate",
+    .description = "same as scan-mmap, with MAP_POPULATE",
+    .setup = populate_setup,
+    .op = populate_op,
+    .verify = scan_verify,
+    .teardown = scan_teardown,
+};
+
+const struct workload workload_scan_mmap_sequential = {
+    .name = "scan-mmap-sequential",
+    .description = "same as scan-mmap, with MADV_SEQUENTIAL",
+    .setup = sequential_setup,
+    .op = sequential_op,
+    .verify = scan_verify,
+    .teardown = scan_teardown,
+};
+
+const struct workload workload_scan_pread = {
+    .name = "scan-pread",
+    .description = "pread a -z MiB file -p pages at a time into a reused buffer",
+    .setup = pread_setup,
+    .op = pread_op,
+    .verify = scan_verify,
+    .teardown = scan_teardown,
+};
+
+const struct workload workload_scan_uring = {
+    .name = "scan-uring",
+    .description = "io_uring-read a -z MiB file -p pages at a time, up to 8 reads in flight",
+    .setup = uring_setup,
+    .op = uring_op,
+    .verify = scan_verify,
+    .teardown = scan_teardown,
+};